@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Compares two builds on the same run.
+#
+#   ./ab-bench.sh <before binary> <after binary> <runs> -- <args...>
+#   ./ab-bench.sh <before binary> <after binary> <runs> -- <before args...> -- <after args...>
+#
+# Each binary is run <runs> times, alternating between the two so that both
+# see the same machine state. Both get the same args unless a second -- gives
+# the args of the after binary, for when the two builds parse an option
+# differently. The median wall time of
+# each is printed with the speedup of the second over the first. Builds that
+# report their own rate (run_from_trace prints "steps/s", run prints "MIPS"
+# in spike-only mode) also get the median of that rate, wall time covers the
+# builds that do not.
+
+set -e
+
+if [ $# -lt 4 ] || [ "$4" != "--" ]; then
+  echo "Usage: $0 <before binary> <after binary> <runs> -- <args...>"
+  echo "       $0 <before binary> <after binary> <runs> -- <before args...> -- <after args...>"
+  exit 1
+fi
+
+BEFORE=$1
+AFTER=$2
+RUNS=$3
+shift 4
+
+BEFORE_ARGS=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  BEFORE_ARGS+=("$1")
+  shift
+done
+if [ $# -gt 0 ]; then
+  shift
+  AFTER_ARGS=("$@")
+else
+  AFTER_ARGS=("${BEFORE_ARGS[@]}")
+fi
+
+LOGDIR=$(mktemp -d)
+echo "logs in $LOGDIR"
+
+median() {
+  sort -g | awk '{ v[NR] = $1 } END { if (NR == 0) exit; print (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+for i in $(seq 1 $RUNS); do
+  for which in before after; do
+    if [ $which == before ]; then
+      BIN=$BEFORE
+      ARGS=("${BEFORE_ARGS[@]}")
+    else
+      BIN=$AFTER
+      ARGS=("${AFTER_ARGS[@]}")
+    fi
+    LOG=$LOGDIR/$which-$i.log
+    START=$(date +%s.%N)
+    $BIN "${ARGS[@]}" > $LOG 2>&1 || echo "$which run $i failed, see $LOG"
+    END=$(date +%s.%N)
+    awk "BEGIN { print $END - $START }" >> $LOGDIR/$which.secs
+    for unit in steps/s MIPS; do
+      grep -o "[0-9.]* $unit" $LOG | awk '{ print $1 }' >> "$LOGDIR/$which.${unit%/s}" || true
+    done
+  done
+done
+
+B_SECS=$(median < $LOGDIR/before.secs)
+A_SECS=$(median < $LOGDIR/after.secs)
+echo "median wall time (s) before: $B_SECS after: $A_SECS speedup: $(awk "BEGIN { printf \"%.3f\", $B_SECS / $A_SECS }")"
+
+for unit in steps/s MIPS; do
+  B_RATE=$(median < "$LOGDIR/before.${unit%/s}")
+  A_RATE=$(median < "$LOGDIR/after.${unit%/s}")
+  if [ -n "$B_RATE" ] && [ -n "$A_RATE" ]; then
+    echo "median $unit before: $B_RATE after: $A_RATE"
+  fi
+done
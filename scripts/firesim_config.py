@@ -204,10 +204,26 @@ class FireSimRuntimeConfig(FireSimTargetConfig):
       print(f'failed to execute firesim {command} -c {str(config_runtime)}')
       exit(1)
 
+  def trace_dir(self) -> Path:
+    return Path(self.default_sim_dir).joinpath('sim_slot_0', 'COSPIKE-TRACES')
+
+  # runworkload returns once the simulation has ended, so every trace file is
+  # closed. COSPIKE-TRACE-<hart>-DONE tells a profiler reading the traces
+  # while they are written that no more files follow.
+  def mark_traces_done(self):
+    harts = set()
+    for trace in self.trace_dir().glob('COSPIKE-TRACE-*'):
+      m = re.match(r'COSPIKE-TRACE-(\d+)-\d+', trace.name)
+      if m:
+        harts.add(m.group(1))
+    for hart in harts:
+      self.trace_dir().joinpath(f'COSPIKE-TRACE-{hart}-DONE').touch()
+
   def run_firesim(self):
     config_runtime = self.dump_config_runtime()
     self.run_firesim_command('infrasetup',  config_runtime)
     self.run_firesim_command('runworkload', config_runtime)
+    self.mark_traces_done()
 
 class ProfilerConfig(FireSimRuntimeConfig):
   spike_only_mode: bool
@@ -251,7 +267,7 @@ class ProfilerConfig(FireSimRuntimeConfig):
       cmdlist = base_cmd_list + user_bin_info + workload
     else:
       sim_slot_dir = Path(self.default_sim_dir).joinpath('sim_slot_0')
-      trace_dir = sim_slot_dir.joinpath('COSPIKE-TRACES')
+      trace_dir = self.trace_dir()
 
       # HACK:
       cospike_config = sim_slot_dir.joinpath('COSPIKE-CONFIG')
@@ -262,12 +278,12 @@ class ProfilerConfig(FireSimRuntimeConfig):
           words = line.split()
           uncompressed_buffer_bytes = int(words[3])
           break
-      insn_per_file = uncompressed_buffer_bytes / 50
+      insn_per_file = uncompressed_buffer_bytes // 50
       trace_cmds = [
           f'--device=sifive_uart',
           f'--dtb={self.dtb()}',
           f'--isa={self.isa}',
-          f'--rtl-cfg=\"{trace_dir}:{self.reader_threads}:{insn_per_file}:{uncompressed_buffer_bytes}\"'
+          f'--rtl-cfg=\"{trace_dir}:{self.reader_threads}:{insn_per_file}\"'
       ]
       cmdlist = base_cmd_list + user_bin_info + trace_cmds + workload
     return cmdlist
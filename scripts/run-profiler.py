@@ -45,8 +45,8 @@ def profiler_run_cmd(config: Dict) -> str:
     trace_dir   = config['rtl_trace_dir']
     reader_threads = config['reader_threads']
     insn_per_file = config['insn_per_file']
-    max_file_bytes = config['max_file_bytes']
-    rtl_cfg  = f"--rtl-cfg=\"{trace_dir}:{reader_threads}:{insn_per_file}:{max_file_bytes}\""
+    chunk_bytes = config.get('chunk_bytes', '')
+    rtl_cfg  = f"--rtl-cfg=\"{trace_dir}:{reader_threads}:{insn_per_file}:{chunk_bytes}\""
 
     rtl_cmd_list = [sifive_uart, dtb, isa, rtl_cfg]
     cmdlist = base_cmd_list + rtl_cmd_list + [workload]
@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flight_recorder.h"
+
+// Prints a dump written by sim_lib_t when the ganged replay diverged
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 4) {
+    printf("Usage ./decode_flight_recorder <FLIGHT-RECORDER.bin> [last n records] [hartid]\n");
+    printf("  Records are printed oldest first, the divergence is at the end.\n");
+    exit(1);
+  }
+
+  std::vector<flight_record_t> records;
+  uint64_t recorded = 0;
+  if (!read_flight_dump(argv[1], records, recorded)) {
+    printf("failed to read flight recorder dump %s\n", argv[1]);
+    exit(1);
+  }
+
+  size_t last = (argc >= 3) ? strtoull(argv[2], NULL, 10) : 0;
+  int hartid = (argc == 4) ? atoi(argv[3]) : -1;
+  size_t first = (last != 0 && last < records.size()) ? records.size() - last : 0;
+
+  printf("%zu of %" PRIu64 " records\n", records.size(), recorded);
+  for (size_t i = first; i < records.size(); i++) {
+    if (hartid >= 0 && records[i].hartid != hartid)
+      continue;
+    print_flight_record(stdout, records[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "trace_bb.h"
+
+// Runs expanded at a time, so that the full trace is never in memory
+#define EXPAND_CHUNK_RUNS 4096
+
+// Writes a BBTRACE file as SPIKETRACE text ("<pc hex> <asid> <cycle>" per
+// instruction), taking the instruction lengths from objdump -d outputs
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    printf("Usage ./expand_bb_trace <BBTRACE> <SPIKETRACE out> <objdump> [<objdump> | <asid>:<objdump> ...]\n");
+    printf("  Objdumps without an asid (kernel, bare metal binary) are used for every asid.\n");
+    exit(1);
+  }
+
+  bb_trace_t bb;
+  if (!read_bb_trace(argv[1], bb)) {
+    printf("failed to read basic block trace %s\n", argv[1]);
+    exit(1);
+  }
+
+  static_code_t code;
+  for (int i = 3; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t colon = arg.find(':');
+    bool ok = (colon == std::string::npos)
+      ? code.add_objdump(arg)
+      : code.add_objdump(arg.substr(colon + 1), atoi(arg.substr(0, colon).c_str()));
+    if (!ok)
+      exit(1);
+  }
+
+  FILE* out = fopen(argv[2], "w");
+  if (out == NULL) {
+    printf("failed to open %s\n", argv[2]);
+    exit(1);
+  }
+
+  trace_t insns;
+  uint64_t ninsns = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && i < bb.size(); i += EXPAND_CHUNK_RUNS) {
+    size_t end = std::min(bb.size(), i + EXPAND_CHUNK_RUNS);
+    bb_trace_t chunk(bb.begin() + i, bb.begin() + end);
+    insns.clear();
+    ok = bb_trace_expand(chunk, code, insns);
+    for (auto& t : insns)
+      fprintf(out, "%" PRIx64 " %" PRIu64 " %" PRIu64 "\n", t.pc, t.asid, t.cycle);
+    ninsns += insns.size();
+  }
+  fclose(out);
+
+  printf("%zu runs, %" PRIu64 " instructions (%.1f per run)\n",
+      bb.size(), ninsns, bb.empty() ? 0.0 : (double)ninsns / bb.size());
+  return ok ? 0 : 1;
+}
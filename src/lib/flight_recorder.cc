@@ -0,0 +1,106 @@
+#include <string.h>
+#include "flight_recorder.h"
+
+flight_recorder_t::flight_recorder_t(size_t capacity) {
+  size_t n = 1;
+  while (n < capacity)
+    n <<= 1;
+  this->slots.resize(n);
+  this->mask = n - 1;
+}
+
+void flight_recorder_t::snapshot(std::vector<flight_record_t>& out) const {
+  out.clear();
+  out.reserve(size());
+  for (uint64_t i = cnt - size(); i < cnt; i++)
+    out.push_back(slots[i & mask]);
+}
+
+bool flight_recorder_t::dump(const std::string& path) const {
+  std::vector<flight_record_t> records;
+  snapshot(records);
+
+  FILE* fp = fopen(path.c_str(), "wb");
+  if (fp == NULL)
+    return false;
+
+  flight_dump_header_t hdr;
+  memcpy(hdr.magic, FLIGHT_DUMP_MAGIC, sizeof(hdr.magic));
+  hdr.version = FLIGHT_DUMP_VERSION;
+  hdr.record_bytes = sizeof(flight_record_t);
+  hdr.nrecords = records.size();
+  hdr.recorded = cnt;
+  bool ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+  ok &= (fwrite(records.data(), sizeof(flight_record_t), records.size(), fp) == records.size());
+  ok &= (fclose(fp) == 0);
+  return ok;
+}
+
+bool read_flight_dump(const std::string& path, std::vector<flight_record_t>& records,
+                      uint64_t& recorded)
+{
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL)
+    return false;
+
+  flight_dump_header_t hdr;
+  bool ok = (fread(&hdr, sizeof(hdr), 1, fp) == 1) &&
+            (memcmp(hdr.magic, FLIGHT_DUMP_MAGIC, sizeof(hdr.magic)) == 0) &&
+            (hdr.version == FLIGHT_DUMP_VERSION) &&
+            (hdr.record_bytes == sizeof(flight_record_t));
+  if (ok) {
+    records.resize(hdr.nrecords);
+    ok = (fread(records.data(), sizeof(flight_record_t), hdr.nrecords, fp) == hdr.nrecords);
+    recorded = hdr.recorded;
+  }
+  fclose(fp);
+
+  if (!ok)
+    records.clear();
+  return ok;
+}
+
+// Register types of the spike commit log key
+static const char* reg_type_name(uint64_t type) {
+  switch (type) {
+    case 0:  return "x";
+    case 1:  return "f";
+    case 2:
+    case 3:  return "v";
+    case 4:  return "csr";
+    default: return "?";
+  }
+}
+
+void print_flight_record(FILE* fp, const flight_record_t& r) {
+  fprintf(fp, "%12" PRIu64 " h%d ", r.seq, r.hartid);
+  switch (r.kind) {
+    case FLIGHT_RTL_STEP:
+      fprintf(fp, "step  t: %" PRIu64 " pc: %" PRIx64, r.a, r.b);
+      if (r.flags & FLIGHT_BATCH)
+        fprintf(fp, " (batch)");
+      else
+        fprintf(fp, " spike pc: %" PRIx64 "%s", r.d,
+            (r.b != r.d && (r.flags & FLIGHT_VAL) && !(r.flags & FLIGHT_EXCEPT)) ? " (mismatch)" : "");
+      fprintf(fp, " v,e,i,h,c,w %d %d %d %d %u %" PRIx64 "\n",
+          !!(r.flags & FLIGHT_VAL), !!(r.flags & FLIGHT_EXCEPT), !!(r.flags & FLIGHT_INTRPT),
+          !!(r.flags & FLIGHT_HAS_W), r.aux, r.c);
+      break;
+    case FLIGHT_REG_WRITE:
+      fprintf(fp, "reg   %s%" PRIu64 " spike: %" PRIx64 " rtl: %" PRIx64 "\n",
+          reg_type_name(r.a & 0xf), r.a >> 4, r.b, r.c);
+      break;
+    case FLIGHT_MEM_WRITE:
+      fprintf(fp, "mem   [%" PRIx64 "] = %" PRIx64 " (%u B)\n", r.a, r.b, r.aux);
+      break;
+    case FLIGHT_DEV_TICK:
+      fprintf(fp, "tick  device %" PRIu64 "\n", r.a);
+      break;
+    case FLIGHT_INTERRUPT:
+      fprintf(fp, "intr  cause %" PRIu64 "\n", r.a);
+      break;
+    default:
+      fprintf(fp, "unknown record kind %d\n", r.kind);
+      break;
+  }
+}
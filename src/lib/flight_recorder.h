@@ -0,0 +1,101 @@
+#ifndef __FLIGHT_RECORDER_H__
+#define __FLIGHT_RECORDER_H__
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Flight recorder
+//
+// The last records of a ganged replay, kept in a fixed ring so that a
+// divergence can be looked at offline (see decode_flight_recorder). Slots
+// are allocated once and overwritten in place, recording a step is a few
+// stores.
+//
+// Dump layout: flight_dump_header_t followed by nrecords flight_record_t,
+// oldest first.
+
+#define FLIGHT_DUMP_MAGIC   "COSPKFLT"
+#define FLIGHT_DUMP_VERSION 1
+
+enum : uint8_t {
+  FLIGHT_RTL_STEP  = 0,  // a: RTL time, b: RTL pc, c: RTL wdata, d: spike pc, aux: cause
+  FLIGHT_REG_WRITE = 1,  // a: spike log key (reg << 4 | type), b: value, c: RTL wdata written over it
+  FLIGHT_MEM_WRITE = 2,  // a: address, b: data, aux: size
+  FLIGHT_DEV_TICK  = 3,  // a: device index
+  FLIGHT_INTERRUPT = 4   // a: cause raised for the RTL interrupt
+};
+
+// flags of FLIGHT_RTL_STEP
+#define FLIGHT_VAL    0x1
+#define FLIGHT_EXCEPT 0x2
+#define FLIGHT_INTRPT 0x4
+#define FLIGHT_HAS_W  0x8
+#define FLIGHT_BATCH  0x10  // replayed by step_lockstep, the spike pc is not recorded
+
+struct flight_record_t {
+  uint64_t seq;     // processor step count when recorded
+  uint64_t a;
+  uint64_t b;
+  uint64_t c;
+  uint64_t d;
+  uint32_t aux;
+  uint8_t  kind;
+  uint8_t  hartid;
+  uint16_t flags;
+};
+
+static_assert(sizeof(flight_record_t) == 48, "flight_record_t layout changed");
+
+struct flight_dump_header_t {
+  char     magic[8];
+  uint32_t version;
+  uint32_t record_bytes;
+  uint64_t nrecords;
+  uint64_t recorded;  // records ever written, the ones before were dropped
+};
+
+class flight_recorder_t {
+public:
+  // capacity is rounded up to a power of two
+  explicit flight_recorder_t(size_t capacity);
+
+  void record(uint8_t kind, uint8_t hartid, uint64_t seq,
+              uint64_t a, uint64_t b = 0, uint64_t c = 0, uint64_t d = 0,
+              uint32_t aux = 0, uint16_t flags = 0) {
+    flight_record_t& r = slots[cnt++ & mask];
+    r.seq = seq;
+    r.a = a;
+    r.b = b;
+    r.c = c;
+    r.d = d;
+    r.aux = aux;
+    r.kind = kind;
+    r.hartid = hartid;
+    r.flags = flags;
+  }
+
+  size_t capacity() const { return mask + 1; }
+  size_t size() const { return cnt < capacity() ? (size_t)cnt : capacity(); }
+  uint64_t recorded() const { return cnt; }
+
+  // Oldest first
+  void snapshot(std::vector<flight_record_t>& out) const;
+
+  bool dump(const std::string& path) const;
+
+private:
+  std::vector<flight_record_t> slots;
+  size_t mask;
+  uint64_t cnt = 0;
+};
+
+// Reads a dump written by flight_recorder_t::dump. Returns false if the file
+// is missing or malformed.
+bool read_flight_dump(const std::string& path, std::vector<flight_record_t>& records,
+                      uint64_t& recorded);
+
+void print_flight_record(FILE* fp, const flight_record_t& r);
+
+#endif // __FLIGHT_RECORDER_H__
@@ -0,0 +1,68 @@
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <inttypes.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() std::this_thread::yield()
+#endif
+
+// Blocking wait for a single-producer/single-consumer handoff.
+// The waiting side spins for a bounded number of iterations and then falls
+// back to sleeping on a condition variable. The signalling side only touches
+// the mutex when someone is actually asleep, so the common case where the
+// other side is keeping up stays lock-free.
+class handoff_waiter_t {
+public:
+  // Returns the number of nanoseconds spent waiting for pred to become true.
+  template <class Pred>
+  uint64_t wait(Pred pred) {
+    if (pred()) return 0;
+
+    auto start = std::chrono::steady_clock::now();
+    bool done = false;
+    for (uint32_t i = 0; i < SPIN_LIMIT; i++) {
+      cpu_relax();
+      if (pred()) {
+        done = true;
+        break;
+      }
+    }
+    if (!done) {
+      std::unique_lock<std::mutex> lock(mutex);
+      sleepers.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      cv.wait(lock, pred);
+      sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  }
+
+  // Must be called after the state that pred() observes has been published.
+  void notify() {
+    // Order the preceding release store before reading the sleeper count,
+    // otherwise we could miss a waiter that is about to go to sleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) > 0) {
+      { std::lock_guard<std::mutex> lock(mutex); }
+      cv.notify_all();
+    }
+  }
+
+private:
+  const uint32_t SPIN_LIMIT = 4096;
+  std::atomic<uint32_t> sleepers{0};
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+#endif // __HANDOFF_H__
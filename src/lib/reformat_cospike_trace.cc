@@ -1,15 +1,244 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <map>
 #include <iostream>
 #include <fstream>
+#include <filesystem>
 #include "string_parser.h"
+#include "trace_reader.h"
+#include "trace_parser.h"
+#include "trace_packed.h"
+#include "trace_codec.h"
+#include "trace_index.h"
+
+#define PACK_CHUNK_BYTES (1 << 20)
+
+// Shortest possible COSPIKE line is "0 0 0 0 0 0 0 0 0\n"
+#define MIN_COSPIKE_LINE_BYTES 18
+
+static uint32_t hartid_from_path(const std::string& path) {
+  std::string name = path.substr(path.find_last_of('/') + 1);
+  uint32_t hartid = 0;
+  sscanf(name.c_str(), "COSPIKE-TRACE-%u-", &hartid);
+  return hartid;
+}
+
+struct out_block_t {
+  std::vector<uint8_t> data;
+  uint64_t steps;
+};
+
+// With blocked set, every block is compressed separately and a block index
+// is written next to the trace (see trace_index.h)
+static bool write_blocks(const char* out_path, std::vector<out_block_t>& blocks, bool blocked) {
+  if (!blocked) {
+    assert(blocks.size() == 1);
+    return write_trace_file(out_path, blocks[0].data.data(), blocks[0].data.size());
+  }
+
+  blocked_trace_writer_t writer(out_path);
+  for (auto& b : blocks) {
+    if (!writer.add_block(b.data.data(), b.data.size(), b.steps))
+      return false;
+  }
+  printf("wrote %zu blocks\n", blocks.size());
+  return writer.close();
+}
+
+// Converts a COSPIKE-TRACE-<hart>-<n>[.gz|.zst|.lz4] text trace into the
+// packed binary format. The output codec is picked from the suffix of out_path.
+static int pack_cospike_trace(const char* in_path, const char* out_path, uint64_t block_steps) {
+  trace_decoder_t* in = open_trace_decoder(in_path);
+  if (in == nullptr) {
+    printf("failed to open %s\n", in_path);
+    return 1;
+  }
+
+  printf("packing file %s\n", in_path);
+
+  packed_trace_header_t hdr;
+  packed_trace_header(hdr, hartid_from_path(in_path));
+  packed_trace_state_t st = {};
+
+  // Every block starts with its own header and delta bases
+  std::vector<out_block_t> blocks;
+  auto new_block = [&]() {
+    blocks.push_back({ std::vector<uint8_t>((uint8_t*)&hdr, (uint8_t*)&hdr + sizeof(hdr)), 0 });
+    st = {};
+  };
+  new_block();
+
+  std::vector<uint8_t> chunk(PACK_CHUNK_BYTES);
+  trace_buffer_t* tbuf = new trace_buffer_t(PACK_CHUNK_BYTES / MIN_COSPIKE_LINE_BYTES + 2);
+  cospike_parser_t parser = cospike_parser();
+
+  size_t carry = 0;
+  uint64_t steps = 0;
+  uint64_t in_bytes = 0;
+  uint64_t out_bytes = 0;
+  int n;
+  while ((n = in->read(chunk.data() + carry, PACK_CHUNK_BYTES - carry)) > 0) {
+    size_t avail = carry + (size_t)n;
+    size_t used = parser(chunk.data(), avail, tbuf);
+    if (used == 0 && avail == PACK_CHUNK_BYTES) {
+      printf("line longer than %d bytes in %s\n", PACK_CHUNK_BYTES, in_path);
+      return 1;
+    }
+
+    while (!tbuf->empty()) {
+      if (block_steps != 0 && blocks.back().steps == block_steps)
+        new_block();
+      packed_trace_encode(tbuf->pop_front(), st, blocks.back().data);
+      blocks.back().steps++;
+      steps++;
+    }
+    tbuf->clear();
+
+    // Keep the partial last line for the next chunk
+    carry = avail - used;
+    memmove(chunk.data(), chunk.data() + used, carry);
+    in_bytes += (uint64_t)n;
+  }
+  if (n < 0) {
+    printf("failed to read %s: %s\n", in_path, in->error().c_str());
+    return 1;
+  }
+  if (carry != 0)
+    printf("dropping %zu bytes of incomplete line at the end of %s\n", carry, in_path);
+
+  delete in;
+  delete tbuf;
+
+  for (auto& b : blocks)
+    out_bytes += b.data.size();
+  if (!write_blocks(out_path, blocks, block_steps != 0)) {
+    printf("failed to write %s\n", out_path);
+    return 1;
+  }
+  printf("packed %" PRIu64 " steps, %" PRIu64 " text bytes -> %" PRIu64 " bytes\n",
+      steps, in_bytes, out_bytes);
+  return 0;
+}
+
+// Rewrites a trace file with the codec picked from the suffix of out_path.
+// Blocking is only supported for text traces, which are split every
+// block_steps lines.
+static int recompress_trace(const char* in_path, const char* out_path, uint64_t block_steps) {
+  trace_decoder_t* in = open_trace_decoder(in_path);
+  if (in == nullptr) {
+    printf("failed to open %s\n", in_path);
+    return 1;
+  }
+
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> chunk(PACK_CHUNK_BYTES);
+  int n;
+  while ((n = in->read(chunk.data(), chunk.size())) > 0)
+    data.insert(data.end(), chunk.begin(), chunk.begin() + n);
+  if (n < 0) {
+    printf("failed to read %s: %s\n", in_path, in->error().c_str());
+    return 1;
+  }
+  delete in;
+
+  std::vector<out_block_t> blocks;
+  if (block_steps == 0) {
+    blocks.push_back({ std::move(data), 0 });
+  } else {
+    if (packed_trace_header_valid(data.data(), data.size())) {
+      printf("%s: use --packed to block packed traces\n", in_path);
+      return 1;
+    }
+    size_t start = 0;
+    uint64_t lines = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (data[i] == '\n' && ++lines == block_steps) {
+        blocks.push_back({ std::vector<uint8_t>(data.begin() + start, data.begin() + i + 1), lines });
+        start = i + 1;
+        lines = 0;
+      }
+    }
+    if (start < data.size())
+      blocks.push_back({ std::vector<uint8_t>(data.begin() + start, data.end()), lines });
+  }
+
+  if (!write_blocks(out_path, blocks, block_steps != 0)) {
+    printf("failed to write %s\n", out_path);
+    return 1;
+  }
+  return 0;
+}
+
+// Writes COSPIKE-TRACE-<hart>-TIME.idx for a trace directory that is not being
+// written anymore. Every unit is decoded once by a trace_reader_t, which
+// records the time range of the units it hands out.
+static int index_trace_dir(const char* dir, int hartid, size_t max_steps) {
+  // One unit per trace file, or per block of a blocked trace file. Packed
+  // files are preferred like the reader does when both versions exist.
+  std::string prefix = "COSPIKE-TRACE-" + std::to_string(hartid) + "-";
+  std::map<uint64_t, std::string> files;
+  std::error_code ec;
+  for (auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (name.compare(0, prefix.size(), prefix) != 0 || !isdigit(name[prefix.size()]))
+      continue;
+    std::string ext = entry.path().extension().string();
+    if (ext == TRACE_INDEX_SUFFIX || ext == ".tmp")
+      continue;
+    uint64_t id = strtoull(name.c_str() + prefix.size(), NULL, 10);
+    auto it = files.find(id);
+    if (it == files.end() || name.find(".bin") != std::string::npos)
+      files[id] = entry.path().string();
+  }
+  if (ec || files.empty()) {
+    printf("no %s* traces in %s\n", prefix.c_str(), dir);
+    return 1;
+  }
+
+  uint64_t nunits = 0;
+  for (auto& f : files) {
+    std::vector<trace_block_t> blocks;
+    nunits += (read_trace_index(f.second, blocks) && !blocks.empty()) ? blocks.size() : 1;
+  }
+
+  trace_reader_t reader(hartid, 0, max_steps, PACK_CHUNK_BYTES, dir);
+  reader.start();
+  for (uint64_t i = 0; i < nunits; i++) {
+    if (reader.cur_buffer() == nullptr)
+      break;
+    reader.pop_buffer();
+  }
+  if (!reader.write_time_index()) {
+    printf("failed to write %s\n", trace_time_index_path(dir, hartid).c_str());
+    return 1;
+  }
+  printf("indexed %zu files (%" PRIu64 " units)\n", files.size(), nunits);
+  return 0;
+}
 
 int main(int argc, char** argv) {
   std::ios_base::sync_with_stdio(false);
   std::cin.tie(NULL);
 
+  if (argc >= 4 && argc <= 5 && strcmp(argv[1], "--packed") == 0)
+    return pack_cospike_trace(argv[2], argv[3], (argc == 5) ? strtoull(argv[4], NULL, 10) : 0);
+  if (argc >= 4 && argc <= 5 && strcmp(argv[1], "--recompress") == 0)
+    return recompress_trace(argv[2], argv[3], (argc == 5) ? strtoull(argv[4], NULL, 10) : 0);
+  if (argc == 5 && strcmp(argv[1], "--time-index") == 0)
+    return index_trace_dir(argv[2], atoi(argv[3]), strtoull(argv[4], NULL, 10));
+
   if (argc < 3) {
     printf("Usage ./reformat_cospike_trace <path to trace> <path to outfile>\n");
+    printf("      ./reformat_cospike_trace --packed <COSPIKE-TRACE-<hart>-<n>.gz> <COSPIKE-TRACE-<hart>-<n>.bin[.gz|.zst|.lz4]> [steps per block]\n");
+    printf("      ./reformat_cospike_trace --recompress <trace> <trace with new suffix (.gz|.zst|.lz4|none)> [steps per block]\n");
+    printf("      ./reformat_cospike_trace --time-index <trace dir> <hartid> <max steps per file>\n");
+    printf("  Passing steps per block writes a blocked trace and its .idx so that\n");
+    printf("  multiple reader threads can decode a single file in parallel.\n");
+    printf("  --time-index writes COSPIKE-TRACE-<hartid>-TIME.idx, which lets a\n");
+    printf("  replay restored from a checkpoint start at an RTL time.\n");
     exit(1);
   }
 
@@ -0,0 +1,88 @@
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <assert.h>
+#include <inttypes.h>
+#include "handoff.h"
+
+// Bounded single-producer/single-consumer queue. The head and tail indices
+// live on their own cache lines and each side caches the other side's
+// index, so the shared lines are only touched when the cached value runs
+// out. A full (or empty) ring blocks the producer (or consumer) through a
+// handoff_waiter_t.
+template <class T>
+class spsc_ring_t {
+public:
+  // capacity is rounded up to a power of two
+  explicit spsc_ring_t(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity)
+      n <<= 1;
+    this->slots.resize(n);
+    this->mask = n - 1;
+  }
+
+  void push(T&& x) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head_cache > mask) {
+      head_cache = head.load(std::memory_order_acquire);
+      if (t - head_cache > mask) {
+        producer_stall += not_full.wait([&] {
+          return t - head.load(std::memory_order_acquire) <= mask;
+        });
+        head_cache = head.load(std::memory_order_acquire);
+      }
+    }
+    slots[t & mask] = std::move(x);
+    tail.store(t + 1, std::memory_order_release);
+    not_empty.notify();
+  }
+
+  void push(const T& x) {
+    T y = x;
+    push(std::move(y));
+  }
+
+  T pop() {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h == tail_cache) {
+      tail_cache = tail.load(std::memory_order_acquire);
+      if (h == tail_cache) {
+        consumer_stall += not_empty.wait([&] {
+          return tail.load(std::memory_order_acquire) != h;
+        });
+        tail_cache = tail.load(std::memory_order_acquire);
+      }
+    }
+    T x = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    not_full.notify();
+    return x;
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+  // Nanoseconds each side spent blocked, only read once both sides are done
+  uint64_t producer_stall_ns() const { return producer_stall; }
+  uint64_t consumer_stall_ns() const { return consumer_stall; }
+
+private:
+  std::vector<T> slots;
+  size_t mask;
+
+  alignas(64) std::atomic<uint64_t> head{0};
+  uint64_t tail_cache = 0;       // consumer side
+  uint64_t consumer_stall = 0;
+
+  alignas(64) std::atomic<uint64_t> tail{0};
+  uint64_t head_cache = 0;       // producer side
+  uint64_t producer_stall = 0;
+
+  alignas(64) handoff_waiter_t not_empty;
+  handoff_waiter_t not_full;
+};
+
+#endif // __SPSC_RING_H__
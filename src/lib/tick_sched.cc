@@ -0,0 +1,38 @@
+
+#include "tick_sched.h"
+#include <algorithm>
+
+void tick_sched_t::schedule(uint32_t id, uint64_t due) {
+  heap.push_back({ due, id });
+  size_t i = heap.size() - 1;
+  while (i > 0) {
+    size_t p = (i - 1) / 2;
+    if (!less(heap[i], heap[p]))
+      break;
+    std::swap(heap[i], heap[p]);
+    i = p;
+  }
+}
+
+bool tick_sched_t::pop_due(uint64_t now, tick_event_t& ev) {
+  if (heap.empty() || heap[0].due > now)
+    return false;
+
+  ev = heap[0];
+  heap[0] = heap.back();
+  heap.pop_back();
+
+  size_t n = heap.size();
+  size_t i = 0;
+  while (true) {
+    size_t l = 2 * i + 1;
+    if (l >= n)
+      break;
+    size_t m = (l + 1 < n && less(heap[l + 1], heap[l])) ? l + 1 : l;
+    if (!less(heap[m], heap[i]))
+      break;
+    std::swap(heap[i], heap[m]);
+    i = m;
+  }
+  return true;
+}
@@ -0,0 +1,41 @@
+#ifndef __TICK_SCHED_H__
+#define __TICK_SCHED_H__
+
+#include <vector>
+#include <stddef.h>
+#include <inttypes.h>
+
+#define TICK_SCHED_NEVER (~0ULL)
+
+struct tick_event_t {
+  uint64_t due;   // step count at which the event fires
+  uint32_t id;    // whatever the caller registered, e.g. a device index
+};
+
+// Events keyed by a step count, in a binary min-heap ordered by due step and
+// then by id, so that events due at the same step always fire in the same
+// order. The pending events are all the state there is: restoring them with
+// schedule() gives the same ticks as before.
+class tick_sched_t {
+public:
+  void schedule(uint32_t id, uint64_t due);
+
+  // Step of the earliest event, TICK_SCHED_NEVER if there is none
+  uint64_t next_due() const { return heap.empty() ? TICK_SCHED_NEVER : heap[0].due; }
+
+  // Removes the earliest event if it is due at or before now
+  bool pop_due(uint64_t now, tick_event_t& ev);
+
+  const std::vector<tick_event_t>& pending() const { return heap; }
+  size_t size() const { return heap.size(); }
+  void clear() { heap.clear(); }
+
+private:
+  static bool less(const tick_event_t& a, const tick_event_t& b) {
+    return a.due != b.due ? a.due < b.due : a.id < b.id;
+  }
+
+  std::vector<tick_event_t> heap;
+};
+
+#endif // __TICK_SCHED_H__
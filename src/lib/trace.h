@@ -5,31 +5,50 @@
 #include <vector>
 #include <stdio.h>
 
+// Hook event at the pc a hart continues at after a step, precomputed by the
+// trace reader threads (see trace_classifier_t in trace_reader.h)
+enum : uint8_t {
+  TRACE_EVENT_NONE    = 0,  // no hook
+  TRACE_EVENT_EXIT    = 1,  // registered function exit
+  TRACE_EVENT_UNKNOWN = 2,  // not classified, the consumer has to look the pc up
+  TRACE_EVENT_FUNC    = 3   // start of registered function (event - TRACE_EVENT_FUNC)
+};
+
+#define TRACE_MAX_EVENT_FUNCS (256 - TRACE_EVENT_FUNC)
+
 struct trace_entry_t {
   uint64_t pc;
   uint64_t asid;
   uint64_t cycle;
 };
 
+// Fields are ordered by size to avoid interior padding (48 instead of 64
+// bytes). Decoded steps are stored back to back in trace_buffer_t.
 struct rtl_step_t {
-  bool val;
   uint64_t time;
   uint64_t pc;
   uint64_t insn;
+  uint64_t wdata;
+  int cause;
+  int priv;
+  bool val;
   bool except;
   bool intrpt;
-  int cause;
   bool has_w;
-  uint64_t wdata;
-  int priv;
+  // Bubbles (steps that neither retire, trap nor take an interrupt) of the
+  // same work unit that the trace reader dropped right before this step. A
+  // longer run than UINT16_MAX keeps every 65536th bubble as a step.
+  uint16_t idle;
+  uint8_t event;
 
   rtl_step_t() {};
 
   rtl_step_t(bool val, uint64_t time, uint64_t pc, uint64_t insn,
       bool except, bool intrpt, int cause, bool has_w, uint64_t wdata,
       int priv)
-    : val(val), time(time), pc(pc), insn(insn), except(except),
-    intrpt(intrpt), cause(cause), has_w(has_w), wdata(wdata), priv(priv)
+    : time(time), pc(pc), insn(insn), wdata(wdata), cause(cause), priv(priv),
+    val(val), except(except), intrpt(intrpt), has_w(has_w), idle(0),
+    event(TRACE_EVENT_UNKNOWN)
   {
   }
 
@@ -39,6 +58,8 @@ struct rtl_step_t {
   }
 };
 
+static_assert(sizeof(rtl_step_t) == 48, "rtl_step_t layout changed");
+
 typedef std::vector<trace_entry_t> trace_t;
 
 #endif //__TRACE_H__
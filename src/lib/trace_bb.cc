@@ -0,0 +1,136 @@
+#include <string.h>
+#include <ctype.h>
+#include <fstream>
+#include "trace_bb.h"
+
+bool static_code_t::add_objdump(const std::string& objdump_path, int asid) {
+  std::ifstream objdump_file(objdump_path, std::ios::binary);
+  if (!objdump_file) {
+    printf("objdump file does not exist: %s\n", objdump_path.c_str());
+    return false;
+  }
+
+  len_map_t& lens = (asid < 0) ? shared : per_asid[(uint64_t)asid];
+  std::string line;
+  while (std::getline(objdump_file, line)) {
+    // "<addr>:\t<encoding>\t<mnemonic> ...", the encoding is printed as one
+    // 16-bit or 32-bit hex word. Symbol lines ("<addr> <func>:") do not
+    // match.
+    uint64_t addr;
+    char enc[17];
+    if (sscanf(line.c_str(), " %" SCNx64 ": %16s", &addr, enc) != 2)
+      continue;
+    size_t digits = strlen(enc);
+    if (digits != 4 && digits != 8)
+      continue;
+    bool hex = true;
+    for (size_t i = 0; i < digits; i++)
+      hex &= (isxdigit((unsigned char)enc[i]) != 0);
+    if (hex)
+      lens[addr] = (uint8_t)(digits / 2);
+  }
+  return true;
+}
+
+int static_code_t::insn_length(uint64_t pc, uint64_t asid) const {
+  auto it = per_asid.find(asid);
+  if (it != per_asid.end()) {
+    auto lit = it->second.find(pc);
+    if (lit != it->second.end())
+      return lit->second;
+  }
+  auto sit = shared.find(pc);
+  return (sit != shared.end()) ? sit->second : 0;
+}
+
+size_t static_code_t::size() const {
+  size_t n = shared.size();
+  for (auto& lens : per_asid)
+    n += lens.second.size();
+  return n;
+}
+
+bool bb_trace_expand(const bb_trace_t& trace, const static_code_t& code, trace_t& out) {
+  for (auto& run : trace) {
+    uint64_t pc = run.pc;
+    for (uint32_t i = 0; i < run.ninsns; i++) {
+      out.push_back({ pc, run.asid, run.cycle + i });
+      if (i + 1 == run.ninsns)
+        break;
+      int len = code.insn_length(pc, run.asid);
+      if (len == 0) {
+        printf("no instruction at pc: %" PRIx64 " asid: %u\n", pc, run.asid);
+        return false;
+      }
+      pc += len;
+    }
+  }
+  return true;
+}
+
+bool write_bb_trace(const std::string& path, const bb_trace_t& trace) {
+  bb_trace_writer_t writer(path);
+  return writer.append(trace) && writer.close();
+}
+
+bool read_bb_trace(const std::string& path, bb_trace_t& trace) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL)
+    return false;
+
+  bb_trace_header_t hdr;
+  bool ok = (fread(&hdr, sizeof(hdr), 1, fp) == 1) &&
+            (memcmp(hdr.magic, BB_TRACE_MAGIC, sizeof(hdr.magic)) == 0) &&
+            (hdr.version == BB_TRACE_VERSION) &&
+            (hdr.entry_bytes == sizeof(bb_trace_entry_t));
+  if (ok) {
+    trace.resize(hdr.nentries);
+    ok = (fread(trace.data(), sizeof(bb_trace_entry_t), hdr.nentries, fp) == hdr.nentries);
+  }
+  fclose(fp);
+
+  if (!ok)
+    trace.clear();
+  return ok;
+}
+
+static bool write_bb_trace_header(FILE* fp, uint64_t nentries) {
+  bb_trace_header_t hdr;
+  memcpy(hdr.magic, BB_TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.version = BB_TRACE_VERSION;
+  hdr.entry_bytes = sizeof(bb_trace_entry_t);
+  hdr.nentries = nentries;
+  return fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+}
+
+bb_trace_writer_t::bb_trace_writer_t(const std::string& path)
+  : path(path), nentries(0)
+{
+  fp = fopen(path.c_str(), "wb");
+  if (fp == NULL || !write_bb_trace_header(fp, 0)) {
+    printf("failed to open %s\n", path.c_str());
+    if (fp != NULL)
+      fclose(fp);
+    fp = NULL;
+  }
+}
+
+bb_trace_writer_t::~bb_trace_writer_t() {
+  close();
+}
+
+bool bb_trace_writer_t::append(const bb_trace_t& trace) {
+  if (fp == NULL)
+    return false;
+  nentries += trace.size();
+  return fwrite(trace.data(), sizeof(bb_trace_entry_t), trace.size(), fp) == trace.size();
+}
+
+bool bb_trace_writer_t::close() {
+  if (fp == NULL)
+    return false;
+  bool ok = (fseek(fp, 0, SEEK_SET) == 0) && write_bb_trace_header(fp, nentries);
+  ok &= (fclose(fp) == 0);
+  fp = NULL;
+  return ok;
+}
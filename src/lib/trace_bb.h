@@ -0,0 +1,113 @@
+#ifndef __TRACE_BB_H__
+#define __TRACE_BB_H__
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "trace.h"
+
+// Basic block compressed pc traces
+//
+// Instead of one trace_entry_t per instruction, a run of instructions that
+// follow each other in memory, under the same asid and one cycle apart, is
+// stored as one bb_trace_entry_t. A new run starts at every control flow
+// discontinuity (taken branch, jump, trap, re-executed instruction) and
+// whenever the asid or the cycle does not continue. The pcs inside a run
+// are recovered from the static code, which only has to give the length of
+// the instruction at a pc (see bb_trace_expand).
+//
+// File layout (BBTRACE): bb_trace_header_t followed by nentries
+// bb_trace_entry_t.
+
+#define BB_TRACE_MAGIC   "COSPKBBT"
+#define BB_TRACE_VERSION 1
+
+struct bb_trace_entry_t {
+  uint64_t pc;      // first pc of the run, the target of a discontinuity
+  uint64_t cycle;   // cycle of the first instruction
+  uint16_t asid;
+  uint16_t hartid;
+  uint32_t ninsns;  // instructions in the run
+};
+
+static_assert(sizeof(bb_trace_entry_t) == 24, "bb_trace_entry_t layout changed");
+
+typedef std::vector<bb_trace_entry_t> bb_trace_t;
+
+struct bb_trace_header_t {
+  char     magic[8];
+  uint32_t version;
+  uint32_t entry_bytes;
+  uint64_t nentries;
+};
+
+// Adds the instruction at pc. cont_pc is the pc that continues the last run
+// (its last pc plus the length of that instruction), so that the static
+// code is not needed while recording.
+static inline void bb_trace_add(bb_trace_t& trace, uint64_t pc, uint64_t asid,
+                                uint64_t cycle, uint64_t cont_pc, int hartid = 0)
+{
+  if (!trace.empty()) {
+    bb_trace_entry_t& last = trace.back();
+    if (pc == cont_pc && (uint16_t)asid == last.asid &&
+        cycle == last.cycle + last.ninsns && last.ninsns != UINT32_MAX) {
+      last.ninsns++;
+      return;
+    }
+  }
+  trace.push_back({ pc, cycle, (uint16_t)asid, (uint16_t)hartid, 1 });
+}
+
+// Length in bytes of the RISC-V instruction starting with the 16-bit parcel
+static inline int riscv_insn_length(uint16_t parcel) {
+  return ((parcel & 0x3) == 0x3) ? 4 : 2;
+}
+
+// Static code of one or more binaries: the length of the instruction at an
+// address, per asid for user binaries and shared by every asid for the
+// kernel (or a bare metal binary).
+class static_code_t {
+public:
+  // Adds every instruction listed in an objdump -d output. asid < 0 shares
+  // them with every asid.
+  bool add_objdump(const std::string& objdump_path, int asid = -1);
+
+  // 0 if the address is not an instruction of a known binary
+  int insn_length(uint64_t pc, uint64_t asid) const;
+
+  size_t size() const;
+
+private:
+  typedef std::unordered_map<uint64_t, uint8_t> len_map_t;
+  len_map_t shared;
+  std::unordered_map<uint64_t, len_map_t> per_asid;
+};
+
+// Appends the trace_entry_t of every instruction of trace to out. Stops
+// and returns false at the first pc that code does not know.
+bool bb_trace_expand(const bb_trace_t& trace, const static_code_t& code, trace_t& out);
+
+bool write_bb_trace(const std::string& path, const bb_trace_t& trace);
+bool read_bb_trace(const std::string& path, bb_trace_t& trace);
+
+// Appends runs to a BBTRACE file as they are recorded, the entry count in
+// the header is filled in by close()
+class bb_trace_writer_t {
+public:
+  bb_trace_writer_t(const std::string& path);
+  ~bb_trace_writer_t();
+
+  bool append(const bb_trace_t& trace);
+  bool close();
+
+  uint64_t entries() const { return nentries; }
+
+private:
+  std::string path;
+  FILE* fp;
+  uint64_t nentries;
+};
+
+#endif // __TRACE_BB_H__
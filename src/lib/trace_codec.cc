@@ -0,0 +1,344 @@
+
+#include <stdio.h>
+#include <zlib.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "trace_codec.h"
+
+#define CODEC_IN_BYTES (1 << 17)
+
+static bool ends_with(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+trace_codec_t trace_codec_from_path(const std::string& path) {
+  for (int c = TRACE_CODEC_GZ; c < TRACE_CODEC_CNT; c++) {
+    if (ends_with(path, trace_codec_suffix((trace_codec_t)c)))
+      return (trace_codec_t)c;
+  }
+  return TRACE_CODEC_RAW;
+}
+
+const char* trace_codec_suffix(trace_codec_t codec) {
+  switch (codec) {
+    case TRACE_CODEC_GZ:   return ".gz";
+    case TRACE_CODEC_ZSTD: return ".zst";
+    case TRACE_CODEC_LZ4:  return ".lz4";
+    default:               return "";
+  }
+}
+
+const char* trace_codec_name(trace_codec_t codec) {
+  switch (codec) {
+    case TRACE_CODEC_GZ:   return "gzip";
+    case TRACE_CODEC_ZSTD: return "zstd";
+    case TRACE_CODEC_LZ4:  return "lz4";
+    default:               return "raw";
+  }
+}
+
+bool trace_codec_available(trace_codec_t codec) {
+  switch (codec) {
+#ifndef HAVE_ZSTD
+    case TRACE_CODEC_ZSTD: return false;
+#endif
+#ifndef HAVE_LZ4
+    case TRACE_CODEC_LZ4:  return false;
+#endif
+    default:               return true;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoders
+///////////////////////////////////////////////////////////////////////////////
+
+// Buffers the compressed input of a decoder. Reads are limited to
+// [offset, offset + bytes) of the file so that single blocks can be decoded.
+class stream_decoder_t : public trace_decoder_t {
+public:
+  stream_decoder_t(FILE* fp, uint64_t bytes)
+    : fp(fp), remaining(bytes), inbuf(CODEC_IN_BYTES), in_pos(0), in_size(0) {}
+  ~stream_decoder_t() { fclose(fp); }
+
+  std::string error() override { return err; }
+
+protected:
+  // Returns false once the input is exhausted or on a read error
+  bool refill() {
+    size_t n = (size_t)std::min((uint64_t)inbuf.size(), remaining);
+    in_pos = 0;
+    in_size = fread(inbuf.data(), 1, n, fp);
+    remaining -= in_size;
+    if (in_size == 0 && ferror(fp))
+      err = "read error";
+    return in_size > 0;
+  }
+
+  // Called at the end of the input, -1 if a stream was cut short
+  int finish(bool in_stream, const char* codec) {
+    if (err.empty() && in_stream)
+      err = std::string("truncated ") + codec + " stream";
+    return err.empty() ? 0 : -1;
+  }
+
+  FILE* fp;
+  uint64_t remaining;
+  std::vector<uint8_t> inbuf;
+  size_t in_pos;
+  size_t in_size;
+  std::string err;
+};
+
+class raw_decoder_t : public stream_decoder_t {
+public:
+  raw_decoder_t(FILE* fp, uint64_t bytes) : stream_decoder_t(fp, bytes) {}
+
+  int read(uint8_t* dst, size_t bytes) override {
+    size_t n = (size_t)std::min((uint64_t)bytes, remaining);
+    n = fread(dst, 1, n, fp);
+    remaining -= n;
+    if (n == 0 && ferror(fp)) {
+      err = "read error";
+      return -1;
+    }
+    return (int)n;
+  }
+};
+
+// Concatenated gzip members are decoded back to back
+class gz_decoder_t : public stream_decoder_t {
+public:
+  gz_decoder_t(FILE* fp, uint64_t bytes) : stream_decoder_t(fp, bytes), pending(false) {
+    memset(&strm, 0, sizeof(strm));
+    inflateInit2(&strm, 16 + MAX_WBITS);
+  }
+  ~gz_decoder_t() { inflateEnd(&strm); }
+
+  int read(uint8_t* dst, size_t bytes) override {
+    strm.next_out = dst;
+    strm.avail_out = (uInt)bytes;
+    while (strm.avail_out > 0) {
+      // inflate may still hold output from the last call even when all of
+      // the input has been consumed
+      if (in_pos == in_size && !pending && !refill()) {
+        // total_in is cleared by inflateReset at the end of every member
+        if (finish(strm.total_in != 0, "gzip") < 0)
+          return -1;
+        break;
+      }
+
+      strm.next_in = inbuf.data() + in_pos;
+      strm.avail_in = (uInt)(in_size - in_pos);
+      int ret = inflate(&strm, Z_NO_FLUSH);
+      in_pos = in_size - strm.avail_in;
+      if (ret == Z_STREAM_END) {
+        inflateReset(&strm);
+      } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        err = strm.msg ? strm.msg : "inflate error";
+        return -1;
+      }
+      pending = (strm.avail_out == 0);
+    }
+    return (int)(bytes - strm.avail_out);
+  }
+
+private:
+  z_stream strm;
+  bool pending;
+};
+
+#ifdef HAVE_ZSTD
+class zstd_decoder_t : public stream_decoder_t {
+public:
+  zstd_decoder_t(FILE* fp, uint64_t bytes)
+    : stream_decoder_t(fp, bytes), pending(false), in_frame(false) {
+    dctx = ZSTD_createDCtx();
+  }
+  ~zstd_decoder_t() { ZSTD_freeDCtx(dctx); }
+
+  int read(uint8_t* dst, size_t bytes) override {
+    ZSTD_outBuffer out = { dst, bytes, 0 };
+    while (out.pos < out.size) {
+      // The decoder may still hold output from the last call even when all
+      // of the input has been consumed
+      if (in_pos == in_size && !pending && !refill()) {
+        if (finish(in_frame, "zstd") < 0)
+          return -1;
+        break;
+      }
+
+      ZSTD_inBuffer in = { inbuf.data(), in_size, in_pos };
+      size_t out_pos = out.pos;
+      size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(ret)) {
+        err = ZSTD_getErrorName(ret);
+        return -1;
+      }
+      // 0 once a frame is completely decoded and flushed. A call that made
+      // no progress says nothing about the frame.
+      if (in.pos != in_pos || out.pos != out_pos)
+        in_frame = (ret != 0);
+      in_pos = in.pos;
+      pending = (out.pos == out.size);
+    }
+    return (int)out.pos;
+  }
+
+private:
+  ZSTD_DCtx* dctx;
+  bool pending;
+  bool in_frame;
+};
+#endif // HAVE_ZSTD
+
+#ifdef HAVE_LZ4
+class lz4_decoder_t : public stream_decoder_t {
+public:
+  lz4_decoder_t(FILE* fp, uint64_t bytes)
+    : stream_decoder_t(fp, bytes), pending(false), in_frame(false) {
+    LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+  }
+  ~lz4_decoder_t() { LZ4F_freeDecompressionContext(dctx); }
+
+  int read(uint8_t* dst, size_t bytes) override {
+    size_t out_pos = 0;
+    while (out_pos < bytes) {
+      if (in_pos == in_size && !pending && !refill()) {
+        if (finish(in_frame, "lz4") < 0)
+          return -1;
+        break;
+      }
+
+      size_t dst_size = bytes - out_pos;
+      size_t src_size = in_size - in_pos;
+      size_t ret = LZ4F_decompress(dctx, dst + out_pos, &dst_size,
+                                   inbuf.data() + in_pos, &src_size, NULL);
+      if (LZ4F_isError(ret)) {
+        err = LZ4F_getErrorName(ret);
+        return -1;
+      }
+      // 0 once a frame is completely decoded, see the zstd decoder
+      if (src_size != 0 || dst_size != 0)
+        in_frame = (ret != 0);
+      in_pos  += src_size;
+      out_pos += dst_size;
+      pending = (out_pos == bytes);
+    }
+    return (int)out_pos;
+  }
+
+private:
+  LZ4F_dctx* dctx;
+  bool pending;
+  bool in_frame;
+};
+#endif // HAVE_LZ4
+
+trace_decoder_t* open_trace_decoder(const std::string& path, uint64_t offset, uint64_t bytes) {
+  trace_codec_t codec = trace_codec_from_path(path);
+  if (!trace_codec_available(codec)) {
+    printf("%s: %s support was not built in\n", path.c_str(), trace_codec_name(codec));
+    return nullptr;
+  }
+
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL) return nullptr;
+  if (offset != 0 && fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+    fclose(fp);
+    return nullptr;
+  }
+  switch (codec) {
+    case TRACE_CODEC_GZ:   return new gz_decoder_t(fp, bytes);
+#ifdef HAVE_ZSTD
+    case TRACE_CODEC_ZSTD: return new zstd_decoder_t(fp, bytes);
+#endif
+#ifdef HAVE_LZ4
+    case TRACE_CODEC_LZ4:  return new lz4_decoder_t(fp, bytes);
+#endif
+    default:               return new raw_decoder_t(fp, bytes);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoders
+///////////////////////////////////////////////////////////////////////////////
+
+bool trace_compress(trace_codec_t codec,
+                    const uint8_t* buf,
+                    size_t bytes,
+                    std::vector<uint8_t>& out)
+{
+  if (!trace_codec_available(codec)) {
+    printf("%s support was not built in\n", trace_codec_name(codec));
+    return false;
+  }
+
+  size_t base = out.size();
+  switch (codec) {
+    case TRACE_CODEC_GZ: {
+      z_stream strm;
+      memset(&strm, 0, sizeof(strm));
+      if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+      out.resize(base + deflateBound(&strm, bytes));
+      strm.next_in = (Bytef*)buf;
+      strm.avail_in = (uInt)bytes;
+      strm.next_out = out.data() + base;
+      strm.avail_out = (uInt)(out.size() - base);
+      int ret = deflate(&strm, Z_FINISH);
+      out.resize(base + strm.total_out);
+      deflateEnd(&strm);
+      return ret == Z_STREAM_END;
+    }
+#ifdef HAVE_ZSTD
+    case TRACE_CODEC_ZSTD: {
+      out.resize(base + ZSTD_compressBound(bytes));
+      size_t n = ZSTD_compress(out.data() + base, out.size() - base, buf, bytes, 3);
+      if (ZSTD_isError(n)) {
+        printf("zstd: %s\n", ZSTD_getErrorName(n));
+        return false;
+      }
+      out.resize(base + n);
+      return true;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case TRACE_CODEC_LZ4: {
+      out.resize(base + LZ4F_compressFrameBound(bytes, NULL));
+      size_t n = LZ4F_compressFrame(out.data() + base, out.size() - base, buf, bytes, NULL);
+      if (LZ4F_isError(n)) {
+        printf("lz4: %s\n", LZ4F_getErrorName(n));
+        return false;
+      }
+      out.resize(base + n);
+      return true;
+    }
+#endif
+    default:
+      out.insert(out.end(), buf, buf + bytes);
+      return true;
+  }
+}
+
+bool write_trace_file(const std::string& path, const uint8_t* buf, size_t bytes) {
+  std::vector<uint8_t> out;
+  if (!trace_compress(trace_codec_from_path(path), buf, bytes, out))
+    return false;
+
+  FILE* fp = fopen(path.c_str(), "wb");
+  if (fp == NULL) return false;
+  bool ok = (fwrite(out.data(), 1, out.size(), fp) == out.size());
+  return (fclose(fp) == 0) && ok;
+}
@@ -0,0 +1,57 @@
+#ifndef __TRACE_CODEC_H__
+#define __TRACE_CODEC_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Compression of COSPIKE trace files, chosen by file suffix:
+//   .gz  : zlib (always available)
+//   .zst : zstd (HAVE_ZSTD)
+//   .lz4 : lz4 frame format (HAVE_LZ4)
+//   none : uncompressed
+enum trace_codec_t {
+  TRACE_CODEC_RAW,
+  TRACE_CODEC_GZ,
+  TRACE_CODEC_ZSTD,
+  TRACE_CODEC_LZ4,
+  TRACE_CODEC_CNT
+};
+
+trace_codec_t trace_codec_from_path(const std::string& path);
+const char* trace_codec_suffix(trace_codec_t codec);
+const char* trace_codec_name(trace_codec_t codec);
+bool trace_codec_available(trace_codec_t codec);
+
+// Sequential reader over a trace file
+class trace_decoder_t {
+public:
+  virtual ~trace_decoder_t() {}
+
+  // Fills up to bytes of dst.
+  // Returns the number of bytes written, 0 at the end of the file or
+  // -1 on error. A file that ends inside a compressed stream is an error.
+  virtual int read(uint8_t* dst, size_t bytes) = 0;
+  virtual std::string error() = 0;
+};
+
+// Decodes the compressed bytes [offset, offset + bytes) of path.
+// Returns nullptr if the file cannot be opened or its codec was not built in.
+trace_decoder_t* open_trace_decoder(const std::string& path,
+                                    uint64_t offset = 0,
+                                    uint64_t bytes = UINT64_MAX);
+
+// Appends the compressed form of buf[0, bytes) to out. Every call produces a
+// self-contained gzip member / zstd frame / lz4 frame, so the results can be
+// concatenated into one file.
+bool trace_compress(trace_codec_t codec,
+                    const uint8_t* buf,
+                    size_t bytes,
+                    std::vector<uint8_t>& out);
+
+// Compresses buf[0, bytes) with the codec picked from the suffix of path and
+// writes it out. Returns false on failure.
+bool write_trace_file(const std::string& path, const uint8_t* buf, size_t bytes);
+
+#endif // __TRACE_CODEC_H__
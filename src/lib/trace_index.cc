@@ -0,0 +1,129 @@
+
+#include <string.h>
+#include "trace_index.h"
+
+bool read_trace_index(const std::string& trace_path, std::vector<trace_block_t>& blocks) {
+  std::string path = trace_path + TRACE_INDEX_SUFFIX;
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL)
+    return false;
+
+  trace_index_header_t hdr;
+  bool ok = (fread(&hdr, sizeof(hdr), 1, fp) == 1) &&
+            (memcmp(hdr.magic, TRACE_INDEX_MAGIC, sizeof(hdr.magic)) == 0) &&
+            (hdr.version == TRACE_INDEX_VERSION);
+  if (ok) {
+    blocks.resize(hdr.nblocks);
+    ok = (fread(blocks.data(), sizeof(trace_block_t), hdr.nblocks, fp) == hdr.nblocks);
+  }
+  fclose(fp);
+
+  if (!ok) {
+    printf("ignoring malformed trace index %s\n", path.c_str());
+    blocks.clear();
+  }
+  return ok;
+}
+
+blocked_trace_writer_t::blocked_trace_writer_t(const std::string& path)
+  : path(path), tmp_path(path + ".tmp"), codec(trace_codec_from_path(path)), offset(0)
+{
+  fp = fopen(tmp_path.c_str(), "wb");
+  if (fp == NULL)
+    printf("failed to open %s\n", tmp_path.c_str());
+}
+
+blocked_trace_writer_t::~blocked_trace_writer_t() {
+  if (fp != NULL)
+    fclose(fp);
+}
+
+bool blocked_trace_writer_t::add_block(const uint8_t* buf, size_t bytes, uint64_t steps) {
+  if (fp == NULL)
+    return false;
+
+  out.clear();
+  if (!trace_compress(codec, buf, bytes, out))
+    return false;
+  if (fwrite(out.data(), 1, out.size(), fp) != out.size())
+    return false;
+
+  blocks.push_back({ offset, out.size(), bytes, steps });
+  offset += out.size();
+  return true;
+}
+
+bool blocked_trace_writer_t::close() {
+  if (fp == NULL)
+    return false;
+
+  bool ok = (fclose(fp) == 0);
+  fp = NULL;
+
+  std::string idx_path = path + TRACE_INDEX_SUFFIX;
+  FILE* idx = fopen(idx_path.c_str(), "wb");
+  if (idx == NULL)
+    return false;
+
+  trace_index_header_t hdr;
+  memcpy(hdr.magic, TRACE_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_INDEX_VERSION;
+  hdr.reserved = 0;
+  hdr.nblocks = blocks.size();
+  ok &= (fwrite(&hdr, sizeof(hdr), 1, idx) == 1);
+  ok &= (fwrite(blocks.data(), sizeof(trace_block_t), blocks.size(), idx) == blocks.size());
+  ok &= (fclose(idx) == 0);
+
+  return ok && (rename(tmp_path.c_str(), path.c_str()) == 0);
+}
+
+std::string trace_time_index_path(const std::string& trace_dir, int hartid) {
+  return trace_dir + "/COSPIKE-TRACE-" + std::to_string(hartid) + "-TIME" + TRACE_INDEX_SUFFIX;
+}
+
+bool read_trace_time_index(const std::string& trace_dir, int hartid,
+                           std::vector<trace_time_unit_t>& units)
+{
+  std::string path = trace_time_index_path(trace_dir, hartid);
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL)
+    return false;
+
+  trace_time_index_header_t hdr;
+  bool ok = (fread(&hdr, sizeof(hdr), 1, fp) == 1) &&
+            (memcmp(hdr.magic, TRACE_TIME_INDEX_MAGIC, sizeof(hdr.magic)) == 0) &&
+            (hdr.version == TRACE_TIME_INDEX_VERSION) &&
+            (hdr.hartid == (uint32_t)hartid);
+  if (ok) {
+    units.resize(hdr.nunits);
+    ok = (fread(units.data(), sizeof(trace_time_unit_t), hdr.nunits, fp) == hdr.nunits);
+  }
+  fclose(fp);
+
+  if (!ok) {
+    printf("ignoring malformed time index %s\n", path.c_str());
+    units.clear();
+  }
+  return ok;
+}
+
+bool write_trace_time_index(const std::string& trace_dir, int hartid,
+                            const std::vector<trace_time_unit_t>& units)
+{
+  std::string path = trace_time_index_path(trace_dir, hartid);
+  std::string tmp_path = path + ".tmp";
+  FILE* fp = fopen(tmp_path.c_str(), "wb");
+  if (fp == NULL)
+    return false;
+
+  trace_time_index_header_t hdr;
+  memcpy(hdr.magic, TRACE_TIME_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_TIME_INDEX_VERSION;
+  hdr.hartid = (uint32_t)hartid;
+  hdr.nunits = units.size();
+  bool ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+  ok &= (fwrite(units.data(), sizeof(trace_time_unit_t), units.size(), fp) == units.size());
+  ok &= (fclose(fp) == 0);
+
+  return ok && (rename(tmp_path.c_str(), path.c_str()) == 0);
+}
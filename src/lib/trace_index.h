@@ -0,0 +1,104 @@
+#ifndef __TRACE_INDEX_H__
+#define __TRACE_INDEX_H__
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "trace_codec.h"
+
+// Blocked trace files
+//
+// A blocked trace file is a concatenation of independently compressed blocks
+// (one gzip member / zstd frame / lz4 frame each) that only contain whole
+// lines, or whole packed records starting with their own packed header.
+// Such a file is still a valid trace file on its own. The sidecar
+// <trace file>.idx lists where each block lives so that the blocks of a
+// single file can be decoded by different reader threads.
+//
+// Index layout: trace_index_header_t followed by nblocks trace_block_t.
+
+#define TRACE_INDEX_SUFFIX  ".idx"
+#define TRACE_INDEX_MAGIC   "COSPKIDX"
+#define TRACE_INDEX_VERSION 1
+
+struct trace_index_header_t {
+  char     magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t nblocks;
+};
+
+struct trace_block_t {
+  uint64_t offset;     // compressed offset in the trace file
+  uint64_t bytes;      // compressed size
+  uint64_t raw_bytes;  // uncompressed size
+  uint64_t steps;
+};
+
+// Reads <trace_path>.idx. Returns false if there is no (valid) index.
+bool read_trace_index(const std::string& trace_path, std::vector<trace_block_t>& blocks);
+
+// Writes a blocked trace file and its index. The codec is picked from the
+// suffix of path. The index is written before the trace file is renamed
+// into place, so a reader never sees a trace file without its index.
+class blocked_trace_writer_t {
+public:
+  blocked_trace_writer_t(const std::string& path);
+  ~blocked_trace_writer_t();
+
+  bool add_block(const uint8_t* buf, size_t bytes, uint64_t steps);
+  bool close();
+
+private:
+  std::string path;
+  std::string tmp_path;
+  trace_codec_t codec;
+  FILE* fp;
+  uint64_t offset;
+  std::vector<uint8_t> out;
+  std::vector<trace_block_t> blocks;
+};
+
+// Time index
+//
+// COSPIKE-TRACE-<hart>-TIME.idx maps RTL time to the work units of the trace
+// of a hart: a whole trace file, or one block of a blocked trace file. Units
+// are listed in trace order, so first_time is non-decreasing and a reader can
+// start decoding at the unit that covers a given time instead of at file 0.
+// It is written by trace_reader_t for the part of a trace it read from the
+// start (see trace_reader_t::write_time_index), or by
+// reformat_cospike_trace --time-index.
+//
+// Index layout: trace_time_index_header_t followed by nunits trace_time_unit_t.
+
+#define TRACE_TIME_INDEX_MAGIC   "COSPKTIM"
+#define TRACE_TIME_INDEX_VERSION 1
+
+struct trace_time_index_header_t {
+  char     magic[8];
+  uint32_t version;
+  uint32_t hartid;
+  uint64_t nunits;
+};
+
+struct trace_time_unit_t {
+  uint64_t file_id;     // n of COSPIKE-TRACE-<hart>-<n>
+  uint64_t offset;      // compressed range in the file, as in trace_block_t
+  uint64_t bytes;       // (UINT64_MAX for a whole file without block index)
+  uint64_t first_time;
+  uint64_t last_time;
+  uint64_t steps;
+};
+
+std::string trace_time_index_path(const std::string& trace_dir, int hartid);
+
+// Returns false if there is no (valid) time index for hartid
+bool read_trace_time_index(const std::string& trace_dir, int hartid,
+                           std::vector<trace_time_unit_t>& units);
+
+// Writes the index to a temporary file first, so readers never see a partial one
+bool write_trace_time_index(const std::string& trace_dir, int hartid,
+                            const std::vector<trace_time_unit_t>& units);
+
+#endif // __TRACE_INDEX_H__
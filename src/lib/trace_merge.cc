@@ -0,0 +1,192 @@
+
+#include "trace_merge.h"
+#include <algorithm>
+#include <thread>
+#include <assert.h>
+
+merged_trace_reader_t::merged_trace_reader_t(const std::vector<int>& hartids, int nthreads,
+                                             size_t per_buff_entries, size_t chunk_bytes, std::string trace_dir,
+                                             size_t mem_budget)
+{
+  assert(!hartids.empty());
+  int nharts = (int)hartids.size();
+  if (nthreads <= 0)
+    nthreads = std::max(std::thread::hardware_concurrency(), 1u);
+  int hart_threads = std::max(nthreads / nharts, 1);
+
+  for (int hartid : hartids) {
+    cursor_t c;
+    c.hartid = hartid;
+    c.reader = new trace_reader_t(hartid, hart_threads, per_buff_entries, chunk_bytes,
+                                  trace_dir, mem_budget / nharts);
+    c.buf = nullptr;
+    c.cur = nullptr;
+    cursors.push_back(c);
+  }
+  this->last_cursor = -1;
+  this->last_end = nullptr;
+  this->started = false;
+}
+
+merged_trace_reader_t::~merged_trace_reader_t() {
+  for (auto& c : cursors)
+    delete c.reader;
+}
+
+void merged_trace_reader_t::set_classifier(const trace_classifier_t* classifier) {
+  for (auto& c : cursors)
+    c.reader->set_classifier(classifier);
+}
+
+void merged_trace_reader_t::start() {
+  for (auto& c : cursors)
+    c.reader->start();
+}
+
+bool merged_trace_reader_t::seek(uint64_t time) {
+  bool ok = true;
+  for (auto& c : cursors)
+    ok &= c.reader->seek(time);
+  return ok;
+}
+
+// Orders by the time of the next step, then by hart
+bool merged_trace_reader_t::less(int a, int b) {
+  const cursor_t& ca = cursors[a];
+  const cursor_t& cb = cursors[b];
+  if (ca.cur->time != cb.cur->time)
+    return ca.cur->time < cb.cur->time;
+  return ca.hartid < cb.hartid;
+}
+
+void merged_trace_reader_t::sift_down(size_t i) {
+  size_t n = heap.size();
+  while (true) {
+    size_t l = 2 * i + 1;
+    if (l >= n)
+      break;
+    size_t m = (l + 1 < n && less(heap[l + 1], heap[l])) ? l + 1 : l;
+    if (!less(heap[m], heap[i]))
+      break;
+    std::swap(heap[i], heap[m]);
+    i = m;
+  }
+}
+
+// Releases the current buffer of the hart and waits for the next non-empty
+// one. Returns false once the trace of the hart has ended.
+bool merged_trace_reader_t::refill(cursor_t& c) {
+  if (c.buf != nullptr)
+    c.reader->pop_buffer();
+
+  while ((c.buf = c.reader->cur_buffer()) != nullptr) {
+    if (!c.buf->empty()) {
+      c.cur = c.buf->begin();
+      return true;
+    }
+    c.reader->pop_buffer();
+  }
+  return false;
+}
+
+bool merged_trace_reader_t::next(trace_run_t& run) {
+  if (!started) {
+    started = true;
+    for (int i = 0; i < (int)cursors.size(); i++) {
+      if (refill(cursors[i]))
+        heap.push_back(i);
+    }
+    for (size_t i = heap.size() / 2; i-- > 0; )
+      sift_down(i);
+  } else if (last_cursor >= 0) {
+    // Consume the previous run, which always belongs to the top of the heap
+    cursor_t& c = cursors[last_cursor];
+    c.cur = last_end;
+    if (c.cur == c.buf->end() && !refill(c)) {
+      heap[0] = heap.back();
+      heap.pop_back();
+    }
+    if (!heap.empty())
+      sift_down(0);
+    last_cursor = -1;
+  }
+  if (heap.empty())
+    return false;
+
+  cursor_t& c = cursors[heap[0]];
+  rtl_step_t* end = c.buf->end();
+  if (heap.size() > 1) {
+    // The second smallest head is one of the root's children
+    int o = heap[1];
+    if (heap.size() > 2 && less(heap[2], o))
+      o = heap[2];
+    const cursor_t& other = cursors[o];
+    uint64_t bound = other.cur->time;
+    if (other.hartid < c.hartid) {
+      end = std::lower_bound(c.cur, end, bound,
+          [](const rtl_step_t& s, uint64_t t) { return s.time < t; });
+    } else {
+      end = std::upper_bound(c.cur, end, bound,
+          [](uint64_t t, const rtl_step_t& s) { return t < s.time; });
+    }
+    // Only reachable when the time of a hart goes backwards
+    if (end == c.cur)
+      end = c.cur + 1;
+  }
+
+  run.hartid = c.hartid;
+  run.first = c.cur;
+  run.last = end;
+  last_cursor = heap[0];
+  last_end = end;
+  return true;
+}
+
+uint64_t merged_trace_reader_t::consumer_stall_ns() {
+  uint64_t ns = 0;
+  for (auto& c : cursors)
+    ns += c.reader->consumer_stall_ns();
+  return ns;
+}
+
+uint64_t merged_trace_reader_t::producer_stall_ns() {
+  uint64_t ns = 0;
+  for (auto& c : cursors)
+    ns += c.reader->producer_stall_ns();
+  return ns;
+}
+
+int merged_trace_reader_t::depth() {
+  int d = 0;
+  for (auto& c : cursors)
+    d += c.reader->depth();
+  return d;
+}
+
+int merged_trace_reader_t::max_depth() {
+  int d = 0;
+  for (auto& c : cursors)
+    d += c.reader->max_depth();
+  return d;
+}
+
+int merged_trace_reader_t::active_threads() {
+  int t = 0;
+  for (auto& c : cursors)
+    t += c.reader->active_threads();
+  return t;
+}
+
+int merged_trace_reader_t::max_active_threads() {
+  int t = 0;
+  for (auto& c : cursors)
+    t += c.reader->max_active_threads();
+  return t;
+}
+
+uint64_t merged_trace_reader_t::bubbles() {
+  uint64_t n = 0;
+  for (auto& c : cursors)
+    n += c.reader->bubbles();
+  return n;
+}
@@ -0,0 +1,91 @@
+#ifndef __TRACE_MERGE_H__
+#define __TRACE_MERGE_H__
+
+#include "trace.h"
+#include "trace_reader.h"
+#include <vector>
+#include <string>
+#include <inttypes.h>
+
+// Consecutive steps of one hart in the merged stream
+struct trace_run_t {
+  int hartid;
+  rtl_step_t* first;
+  rtl_step_t* last;
+
+  rtl_step_t* begin() { return first; }
+  rtl_step_t* end()   { return last; }
+  size_t size()       { return last - first; }
+};
+
+// Reads COSPIKE-TRACE-<hart>-* of several harts in parallel, one
+// trace_reader_t per hart, and merges them into a single stream ordered by
+// time. Steps with the same time are ordered by hart.
+//
+// The merge is a k-way merge over a binary min-heap of the per-hart buffers,
+// keyed by the time of their first unconsumed step. Instead of single steps,
+// next() returns runs: the hart at the top of the heap may run ahead up to the
+// head of the second smallest hart (one of the root's children), and the
+// end of the run is found by binary search as times within a hart increase
+// monotonically. With a single hart no merging is needed and every run is a
+// whole buffer.
+class merged_trace_reader_t {
+public:
+  // nthreads and mem_budget are shared between the harts
+  merged_trace_reader_t(const std::vector<int>& hartids, int nthreads,
+                        size_t per_buff_entries, size_t chunk_bytes, std::string trace_dir,
+                        size_t mem_budget = TRACE_READER_MEM_BUDGET);
+  ~merged_trace_reader_t();
+
+  // See trace_reader_t::set_classifier, shared by all harts
+  void set_classifier(const trace_classifier_t* classifier);
+  void start();
+
+  // Starts every hart at time, see trace_reader_t::seek. Returns false if any
+  // hart has to be decoded from the start. spike has to be restored to the
+  // architectural state at time, as sim_lib_t::run_from_trace does with an
+  // RTL checkpoint (--rtl-ckpt-load): replaying from reset after a seek
+  // diverges at the first step.
+  bool seek(uint64_t time);
+
+  // Returns the next run of the merged stream. The steps stay valid until
+  // the next call. Blocks while the next step of any hart is not decoded
+  // yet, and returns false once the traces of all harts have ended.
+  bool next(trace_run_t& run);
+
+  // Number of harts whose trace has not ended yet
+  int active_harts() { return (int)heap.size(); }
+
+  // Summed over the per-hart readers
+  uint64_t consumer_stall_ns();
+  uint64_t producer_stall_ns();
+  int depth();
+  int max_depth();
+  int active_threads();
+  int max_active_threads();
+  uint64_t bubbles();
+
+private:
+  struct cursor_t {
+    int hartid;
+    trace_reader_t* reader;
+    trace_buffer_t* buf;   // nullptr once the trace of the hart has ended
+    rtl_step_t* cur;
+  };
+
+  bool less(int a, int b);
+  void sift_down(size_t i);
+  bool refill(cursor_t& c);
+
+  std::vector<cursor_t> cursors;
+
+  // Indices into cursors of the harts with steps left, heap ordered
+  std::vector<int> heap;
+
+  // Cursor and end of the run handed out by the last call to next()
+  int last_cursor;
+  rtl_step_t* last_end;
+  bool started;
+};
+
+#endif // __TRACE_MERGE_H__
@@ -0,0 +1,143 @@
+
+#include <string.h>
+#include <assert.h>
+#include "trace_packed.h"
+#include "trace_reader.h"
+
+static inline uint64_t zigzag(uint64_t delta) {
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t z) {
+  return (z >> 1) ^ (~(z & 1) + 1);
+}
+
+static inline void put_varint(uint64_t x, std::vector<uint8_t>& out) {
+  while (x >= 0x80) {
+    out.push_back((uint8_t)(x | 0x80));
+    x >>= 7;
+  }
+  out.push_back((uint8_t)x);
+}
+
+// Caller guarantees that the varint fits in buf[i, end).
+static inline uint64_t get_varint(const uint8_t* buf, size_t& i) {
+  uint64_t x = 0;
+  int shift = 0;
+  uint8_t b;
+  do {
+    b = buf[i++];
+    x |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return x;
+}
+
+// Returns the size of the record starting at buf[0] or 0 if it is not
+// completely contained in buf[0, bytes)
+static size_t record_bytes(const uint8_t* buf, size_t bytes) {
+  if (bytes == 0) return 0;
+  size_t i = 1;
+  for (int v = 0; v < 3; v++) {
+    do {
+      if (i >= bytes) return 0;
+    } while (buf[i++] & 0x80);
+  }
+  if (buf[0] & PACKED_FLAG_HAS_W)
+    i += sizeof(uint64_t);
+  return (i <= bytes) ? i : 0;
+}
+
+void packed_trace_header(packed_trace_header_t& hdr, uint32_t hartid) {
+  memcpy(hdr.magic, PACKED_TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.version = PACKED_TRACE_VERSION;
+  hdr.hartid = hartid;
+}
+
+bool packed_trace_header_valid(const uint8_t* buf, size_t bytes) {
+  if (bytes < sizeof(packed_trace_header_t))
+    return false;
+
+  packed_trace_header_t hdr;
+  memcpy(&hdr, buf, sizeof(hdr));
+  return (memcmp(hdr.magic, PACKED_TRACE_MAGIC, sizeof(hdr.magic)) == 0) &&
+         (hdr.version == PACKED_TRACE_VERSION);
+}
+
+void packed_trace_encode(const rtl_step_t& step,
+                         packed_trace_state_t& st,
+                         std::vector<uint8_t>& out)
+{
+  uint8_t flags = (step.val    ? PACKED_FLAG_VAL    : 0) |
+                  (step.except ? PACKED_FLAG_EXCEPT : 0) |
+                  (step.intrpt ? PACKED_FLAG_INTRPT : 0) |
+                  (step.has_w  ? PACKED_FLAG_HAS_W  : 0);
+  out.push_back(flags);
+  put_varint((uint64_t)step.cause, out);
+  put_varint(zigzag(step.time - st.time), out);
+  put_varint(zigzag(step.pc - st.pc), out);
+  if (step.has_w) {
+    for (int i = 0; i < 8; i++)
+      out.push_back((uint8_t)(step.wdata >> (8 * i)));
+  }
+  st.time = step.time;
+  st.pc = step.pc;
+}
+
+size_t packed_trace_decode(const uint8_t* buf,
+                           size_t bytes,
+                           packed_trace_state_t& st,
+                           trace_buffer_t* tbuf)
+{
+  size_t i = 0;
+  while (i < bytes) {
+    // Flags only use the low bits, so anything else starts a file header.
+    // Blocked files (trace_index.h) have one at the start of every block.
+    if (buf[i] & ~PACKED_FLAG_MASK) {
+      if (bytes - i < sizeof(packed_trace_header_t))
+        break;
+      assert(packed_trace_header_valid(buf + i, bytes - i));
+      st.time = 0;
+      st.pc = 0;
+      i += sizeof(packed_trace_header_t);
+      continue;
+    }
+
+    // Only pay for the bounds checks close to the end of the buffer
+    if (bytes - i < PACKED_MAX_RECORD_BYTES &&
+        record_bytes(buf + i, bytes - i) == 0)
+      break;
+
+    uint8_t flags = buf[i++];
+    int cause = (int)get_varint(buf, i);
+    st.time  += unzigzag(get_varint(buf, i));
+    st.pc    += unzigzag(get_varint(buf, i));
+    bool has_w = flags & PACKED_FLAG_HAS_W;
+    if (tbuf->drop_bubble(flags & PACKED_FLAG_VAL,
+                          flags & PACKED_FLAG_EXCEPT,
+                          flags & PACKED_FLAG_INTRPT)) {
+      // The delta bases still advance over dropped steps
+      if (has_w)
+        i += sizeof(uint64_t);
+      continue;
+    }
+
+    rtl_step_t& step = tbuf->push_back();
+    step.val    = flags & PACKED_FLAG_VAL;
+    step.except = flags & PACKED_FLAG_EXCEPT;
+    step.intrpt = flags & PACKED_FLAG_INTRPT;
+    step.has_w  = has_w;
+    step.cause  = cause;
+    step.time   = st.time;
+    step.pc     = st.pc;
+    if (has_w) {
+      uint64_t wdata;
+      memcpy(&wdata, buf + i, sizeof(wdata));
+      step.wdata = wdata;
+      i += sizeof(wdata);
+    } else {
+      step.wdata = 0;
+    }
+  }
+  return i;
+}
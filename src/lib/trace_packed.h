@@ -0,0 +1,65 @@
+#ifndef __TRACE_PACKED_H__
+#define __TRACE_PACKED_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+#include "trace.h"
+
+class trace_buffer_t;
+
+// Packed binary COSPIKE traces (COSPIKE-TRACE-<hart>-<n>.bin)
+//
+// Each file starts with a packed_trace_header_t followed by one record per
+// step:
+//   u8     flags   : val | except << 1 | intrpt << 2 | has_w << 3
+//   varint cause
+//   varint time    : zigzag(time - prev time)
+//   varint pc      : zigzag(pc - prev pc)
+//   u64    wdata   : little endian, only present when has_w is set
+//
+// The delta bases start at zero after every header so that files (and the
+// blocks of a blocked file) can be decoded independently of each other.
+
+#define PACKED_TRACE_MAGIC   "COSPKBIN"
+#define PACKED_TRACE_VERSION 1
+
+#define PACKED_FLAG_VAL    (1 << 0)
+#define PACKED_FLAG_EXCEPT (1 << 1)
+#define PACKED_FLAG_INTRPT (1 << 2)
+#define PACKED_FLAG_HAS_W  (1 << 3)
+#define PACKED_FLAG_MASK   0x0f
+
+// flags + three 10 byte varints + wdata
+#define PACKED_MAX_RECORD_BYTES (1 + 3 * 10 + 8)
+
+struct packed_trace_header_t {
+  char     magic[8];
+  uint32_t version;
+  uint32_t hartid;
+};
+
+// Delta bases carried across records
+struct packed_trace_state_t {
+  uint64_t time;
+  uint64_t pc;
+};
+
+void packed_trace_header(packed_trace_header_t& hdr, uint32_t hartid);
+bool packed_trace_header_valid(const uint8_t* buf, size_t bytes);
+
+// Appends the encoding of step to out
+void packed_trace_encode(const rtl_step_t& step,
+                         packed_trace_state_t& st,
+                         std::vector<uint8_t>& out);
+
+// Decodes the complete records in buf[0, bytes) into tbuf, skipping over
+// (and resetting st at) any file headers. A trailing partial record is left
+// untouched.
+// Returns the number of bytes consumed.
+size_t packed_trace_decode(const uint8_t* buf,
+                           size_t bytes,
+                           packed_trace_state_t& st,
+                           trace_buffer_t* tbuf);
+
+#endif // __TRACE_PACKED_H__
@@ -0,0 +1,265 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "trace_parser.h"
+#include "trace_reader.h"
+
+#define FIELD_TIME   1
+#define FIELD_PC     2
+#define FIELD_VAL    3
+#define FIELD_EXCEPT 4
+#define FIELD_INTRPT 5
+#define FIELD_HAS_W  6
+#define FIELD_CAUSE  7
+#define FIELD_WDATA  8
+
+static inline void commit_step(trace_buffer_t* tbuf, const uint64_t* trace_members) {
+  if (tbuf->drop_bubble(trace_members[FIELD_VAL],
+                        trace_members[FIELD_EXCEPT],
+                        trace_members[FIELD_INTRPT]))
+    return;
+
+  rtl_step_t& step = tbuf->push_back();
+  step.time    = trace_members[FIELD_TIME];
+  step.pc      = trace_members[FIELD_PC];
+  step.val     = trace_members[FIELD_VAL];
+  step.except  = trace_members[FIELD_EXCEPT];
+  step.intrpt  = trace_members[FIELD_INTRPT];
+  step.has_w   = trace_members[FIELD_HAS_W];
+  step.cause   = trace_members[FIELD_CAUSE];
+  step.wdata   = trace_members[FIELD_WDATA];
+}
+
+// Bytes up to and including the last '\n'
+static inline size_t complete_lines(const uint8_t* buf, size_t bytes) {
+  const void* last_nl = memrchr(buf, '\n', bytes);
+  return last_nl ? (size_t)((const uint8_t*)last_nl - buf) + 1 : 0;
+}
+
+size_t parse_cospike_scalar(const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf) {
+  size_t end = complete_lines(buf, bytes);
+  size_t i = 0;
+  int digits[] = {0, 10, 16, 10, 10, 10, 10, 10, 16};
+  uint64_t trace_members[] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+  while (i < end) {
+    int index = 0;
+    char cur_char = (char)buf[i];
+    while (cur_char != '\n') {
+      uint64_t x = 0;
+      while (cur_char != ' ' && cur_char != '\n') {
+        int v = cur_char >= 97 ? cur_char - 87 : cur_char - '0';
+        x = (x * digits[index]) + v;
+        cur_char = (char)buf[++i];
+      }
+      trace_members[index++] = x;
+      if (cur_char == ' ')
+        cur_char = (char)buf[++i];
+    }
+    i++;
+    commit_step(tbuf, trace_members);
+  }
+  return end;
+}
+
+#if defined(__x86_64__)
+
+///////////////////////////////////////////////////////////////////////////////
+// SWAR field decoders
+//
+// Both decoders load 8 bytes at a time, so the caller has to guarantee that
+// at least 8 readable bytes follow the start of every chunk.
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t load_u64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Up to 8 decimal digits, most significant digit at p[0]
+static inline uint64_t swar_dec8(const uint8_t* p, size_t len) {
+  uint64_t v = load_u64(p) & 0x0F0F0F0F0F0F0F0FULL;
+  v <<= (8 - len) * 8;
+  v = (v * 2561) >> 8;
+  v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+  return ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+
+// Up to 8 lowercase hex digits, most significant digit at p[0]
+static inline uint64_t swar_hex8(const uint8_t* p, size_t len) {
+  uint64_t v = load_u64(p);
+  // '0'-'9' -> 0-9, 'a'-'f' -> 10-15
+  v = (v & 0x0F0F0F0F0F0F0F0FULL) + ((v & 0x4040404040404040ULL) >> 6) * 9;
+  v <<= (8 - len) * 8;
+  v = ((v & 0x000F000F000F000FULL) << 4) | ((v & 0x0F000F000F000F00ULL) >> 8);
+  v = ((v & 0x000000FF000000FFULL) << 8) | ((v & 0x00FF000000FF0000ULL) >> 16);
+  v = ((v & 0x000000000000FFFFULL) << 16) | ((v & 0x0000FFFF00000000ULL) >> 32);
+  return v;
+}
+
+static inline uint64_t swar_dec(const uint8_t* p, size_t len) {
+  size_t head = ((len - 1) & 7) + 1;
+  uint64_t x = swar_dec8(p, head);
+  for (size_t i = head; i < len; i += 8)
+    x = x * 100000000ULL + swar_dec8(p + i, 8);
+  return x;
+}
+
+static inline uint64_t swar_hex(const uint8_t* p, size_t len) {
+  size_t head = ((len - 1) & 7) + 1;
+  uint64_t x = swar_hex8(p, head);
+  for (size_t i = head; i < len; i += 8)
+    x = (x << 32) | swar_hex8(p + i, 8);
+  return x;
+}
+
+static inline uint64_t scalar_field(const uint8_t* p, size_t len, uint64_t radix) {
+  uint64_t x = 0;
+  for (size_t i = 0; i < len; i++) {
+    int v = p[i] >= 97 ? p[i] - 87 : p[i] - '0';
+    x = (x * radix) + v;
+  }
+  return x;
+}
+
+// Tokenizer state carried between delimiter blocks
+struct cospike_tokenizer_t {
+  size_t field_start;
+  int index;
+  uint64_t trace_members[COSPIKE_FIELDS];
+};
+
+static inline void decode_field(cospike_tokenizer_t& tok,
+                                const uint8_t* buf,
+                                size_t pos,
+                                size_t end)
+{
+  size_t start = tok.field_start;
+  size_t len = pos - start;
+  int index = tok.index;
+  if (index == 0 || index >= COSPIKE_FIELDS)
+    return;
+
+  bool hex = (index == FIELD_PC || index == FIELD_WDATA);
+  uint64_t x;
+  if (len == 0) {
+    // A trailing space before the newline does not start a new field
+    if (buf[pos] == '\n')
+      return;
+    x = 0;
+  } else if (len == 1) {
+    x = scalar_field(buf + start, 1, 10);
+  } else if (start + ((len + 7) & ~(size_t)7) <= end) {
+    x = hex ? swar_hex(buf + start, len) : swar_dec(buf + start, len);
+  } else {
+    // Too close to the end of the buffer for the 8 byte loads
+    x = scalar_field(buf + start, len, hex ? 16 : 10);
+  }
+  tok.trace_members[index] = x;
+}
+
+// Consumes the delimiters (' ' or '\n') flagged in mask, which covers
+// buf[base, base + 32).
+static inline void tokenize_block(cospike_tokenizer_t& tok,
+                                  const uint8_t* buf,
+                                  size_t base,
+                                  uint32_t mask,
+                                  size_t end,
+                                  trace_buffer_t* tbuf)
+{
+  while (mask) {
+    size_t pos = base + __builtin_ctz(mask);
+    mask &= mask - 1;
+
+    decode_field(tok, buf, pos, end);
+    tok.index++;
+    tok.field_start = pos + 1;
+    if (buf[pos] == '\n') {
+      commit_step(tbuf, tok.trace_members);
+      tok.index = 0;
+    }
+  }
+}
+
+static inline uint32_t scalar_delim_mask(const uint8_t* p, size_t len) {
+  uint32_t mask = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == ' ' || p[i] == '\n')
+      mask |= (1u << i);
+  }
+  return mask;
+}
+
+__attribute__((target("sse4.2")))
+size_t parse_cospike_sse42(const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf) {
+  size_t end = complete_lines(buf, bytes);
+  cospike_tokenizer_t tok = {};
+
+  const __m128i delims = _mm_setr_epi8(' ', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  const int mode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK;
+
+  size_t i = 0;
+  for (; i + 32 <= end; i += 32) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(buf + i));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(buf + i + 16));
+    uint32_t mlo = (uint32_t)_mm_cvtsi128_si32(_mm_cmpestrm(delims, 2, lo, 16, mode));
+    uint32_t mhi = (uint32_t)_mm_cvtsi128_si32(_mm_cmpestrm(delims, 2, hi, 16, mode));
+    tokenize_block(tok, buf, i, (mlo & 0xffff) | (mhi << 16), end, tbuf);
+  }
+  if (i < end)
+    tokenize_block(tok, buf, i, scalar_delim_mask(buf + i, end - i), end, tbuf);
+  return end;
+}
+
+__attribute__((target("avx2")))
+size_t parse_cospike_avx2(const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf) {
+  size_t end = complete_lines(buf, bytes);
+  cospike_tokenizer_t tok = {};
+
+  const __m256i space   = _mm256_set1_epi8(' ');
+  const __m256i newline = _mm256_set1_epi8('\n');
+
+  size_t i = 0;
+  for (; i + 32 <= end; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+    __m256i d = _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                _mm256_cmpeq_epi8(v, newline));
+    tokenize_block(tok, buf, i, (uint32_t)_mm256_movemask_epi8(d), end, tbuf);
+  }
+  if (i < end)
+    tokenize_block(tok, buf, i, scalar_delim_mask(buf + i, end - i), end, tbuf);
+  return end;
+}
+
+#endif // __x86_64__
+
+static cospike_parser_t select_cospike_parser() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return parse_cospike_avx2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return parse_cospike_sse42;
+#endif
+  return parse_cospike_scalar;
+}
+
+cospike_parser_t cospike_parser() {
+  static const cospike_parser_t parser = select_cospike_parser();
+  return parser;
+}
+
+const char* cospike_parser_name(cospike_parser_t parser) {
+#if defined(__x86_64__)
+  if (parser == parse_cospike_avx2)  return "avx2";
+  if (parser == parse_cospike_sse42) return "sse4.2";
+#endif
+  return "scalar";
+}
@@ -0,0 +1,29 @@
+#ifndef __TRACE_PARSER_H__
+#define __TRACE_PARSER_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+class trace_buffer_t;
+
+// COSPIKE text traces contain one retired (or bubble) step per line:
+//   <hart> <time> <pc> <val> <except> <intrpt> <has_w> <cause> <wdata>\n
+// time and cause are decimal, pc and wdata are lowercase hex.
+#define COSPIKE_FIELDS 9
+
+// Parses the complete lines in buf[0, bytes) and appends one step per line
+// to tbuf. A trailing line without a '\n' is left untouched.
+// Returns the number of bytes consumed.
+typedef size_t (*cospike_parser_t)(const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf);
+
+size_t parse_cospike_scalar(const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf);
+#if defined(__x86_64__)
+size_t parse_cospike_sse42 (const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf);
+size_t parse_cospike_avx2  (const uint8_t* buf, size_t bytes, trace_buffer_t* tbuf);
+#endif
+
+// Fastest parser supported by the host CPU (chosen once, at first use)
+cospike_parser_t cospike_parser();
+const char* cospike_parser_name(cospike_parser_t parser);
+
+#endif // __TRACE_PARSER_H__
@@ -1,182 +1,624 @@
 
 #include "trace_reader.h"
+#include "trace_parser.h"
+#include "trace_packed.h"
+#include "trace_codec.h"
 #include <sys/stat.h>
-#include <zlib.h>
 #include <filesystem>
 #include <assert.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
 
-trace_buffer_t::trace_buffer_t(size_t max_entries, size_t max_file_bytes) {
-  for (size_t i = 0; i < max_entries + 1; i++) this->trace.push_back(new rtl_step_t());
-  this->buffer = (uint8_t*)malloc(sizeof(uint8_t) * max_file_bytes);
-  this->max_file_bytes = max_file_bytes;
-  this->max_entries = max_entries + 1;
+trace_buffer_t::trace_buffer_t(size_t max_entries, bool filter_bubbles) {
+  size_t bytes = sizeof(rtl_step_t) * std::max(max_entries, (size_t)1);
+  bytes = (bytes + TRACE_BUFFER_ALIGN - 1) & ~(size_t)(TRACE_BUFFER_ALIGN - 1);
+  this->steps = (rtl_step_t*)aligned_alloc(TRACE_BUFFER_ALIGN, bytes);
+  assert(this->steps != nullptr);
+  this->max_entries = max_entries;
   this->head = 0;
-  this->tail = 1;
-  this->consumable = false;
+  this->tail = 0;
+  this->filter_bubbles = filter_bubbles;
+  this->idle = 0;
+  this->nbubbles = 0;
 }
 
 trace_buffer_t::~trace_buffer_t() {
-  delete this->buffer;
+  free(this->steps);
 }
 
-bool trace_buffer_t::empty() {
-  return ((head + 1) % max_entries == tail);
+void trace_slot_t::publish(uint64_t gen, trace_buffer_t* buf) {
+  this->buf = buf;
+  published.store(gen + 1, std::memory_order_release);
+  waiter.notify();
 }
 
-bool trace_buffer_t::full() {
-  return (head == (tail + 1) % max_entries);
+uint64_t trace_slot_t::wait_until_published(uint64_t gen,
+                                            uint64_t seq,
+                                            std::atomic<uint64_t>& end_seq)
+{
+  return waiter.wait([this, gen, seq, &end_seq] {
+      return published.load(std::memory_order_acquire) == gen + 1 ||
+             seq >= end_seq.load(std::memory_order_acquire);
+      });
 }
 
-bool trace_buffer_t::can_consume() {
-  bool ret;
-  {
-    std::unique_lock<std::mutex> lock(consumable_mutex);
-    ret = consumable;
+trace_buffer_t* trace_slot_t::take() {
+  trace_buffer_t* b = buf;
+  buf = nullptr;
+  return b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+trace_reader_t::trace_reader_t(int hartid, int nthreads, size_t per_buff_entries, size_t chunk_bytes, std::string trace_dir,
+                               size_t mem_budget)
+{
+  this->trace_dir = trace_dir;
+  this->hartid = hartid;
+  this->consumer_seq = 0;
+  this->trace_id = 0;
+  this->unit_id = 0;
+  this->next_block = 0;
+  this->end_unit = UINT64_MAX;
+  this->format = TRACE_FMT_UNKNOWN;
+  this->chunk_bytes = std::min(std::max(chunk_bytes, (size_t)TRACE_MIN_CHUNK_BYTES),
+                               (size_t)TRACE_MAX_CHUNK_BYTES);
+  this->per_buff_entries = per_buff_entries;
+  this->mem_budget = mem_budget;
+  this->nthreads = (nthreads > 0) ? nthreads : std::max(std::thread::hardware_concurrency(), 1u);
+  this->should_terminate = false;
+  this->consumer_stall_ns_ = 0;
+  this->producer_stall_ns_ = 0;
+  this->decode_ns_ = 0;
+  this->decoded_units_ = 0;
+  this->bubbles_ = 0;
+  this->consumed = 0;
+  this->nallocated = 0;
+  this->cur_file_id = 0;
+  this->classifier = nullptr;
+  this->seek_time = 0;
+  this->from_start = true;
+  std::vector<trace_time_unit_t> indexed;
+  this->indexed_units = read_trace_time_index(trace_dir, hartid, indexed) ? indexed.size() : 0;
+
+  // Never decode further ahead than the budget allows even with one thread
+  size_t buf_bytes = std::max(per_buff_entries * sizeof(rtl_step_t), (size_t)1);
+  size_t nslots = std::min(std::max(mem_budget / buf_bytes, (size_t)2), (size_t)TRACE_MAX_DEPTH);
+  for (size_t i = 0; i < nslots; i++) {
+    this->slots.push_back(new trace_slot_t());
+  }
+
+  // Start small, adapt() grows the pool once it has measured both sides
+  int threads = std::min(this->nthreads, 2);
+  int depth = std::min(threads + 1, (int)nslots);
+  fit_budget(threads, depth);
+  if (pool_bytes(1, 2) > mem_budget) {
+    printf("trace_reader hart %d: memory budget of %zu bytes is below the minimum of %zu bytes\n",
+        hartid, mem_budget, pool_bytes(1, 2));
   }
-  return ret;
+  this->active_threads_ = threads;
+  this->depth_ = depth;
+  this->max_active_threads_ = threads;
+  this->max_depth_ = depth;
+  this->watcher = new trace_watcher_t(trace_dir, hartid);
 }
 
-void trace_buffer_t::done_consume() {
-  {
-    std::unique_lock<std::mutex> lock(consumable_mutex);
-    consumable = false;
+trace_reader_t::~trace_reader_t() {
+  should_terminate = true;
+  watcher->wakeup();
+  admit_waiter.notify();
+  park_waiter.notify();
+  for (auto& s : this->slots)
+    s->wakeup();
+
+  for (auto& t : threads)
+    t.join();
+
+  // The replay usually stops before the end of the trace
+  update_time_index();
+
+  // Units that were published but never consumed still hold their buffer
+  for (auto& s : this->slots) {
+    delete s->take();
+    delete s;
   }
+  for (auto& b : this->free_buffers)
+    delete b;
+  delete watcher;
 }
 
-uint8_t* trace_buffer_t::get_buffer() {
-  return buffer;
+trace_buffer_t* trace_reader_t::cur_buffer() {
+  uint64_t nslots = slots.size();
+  trace_slot_t* slot = slots[consumer_seq % nslots];
+  uint64_t stall = slot->wait_until_published(consumer_seq / nslots, consumer_seq, end_unit);
+  consumer_stall_ns_.fetch_add(stall, std::memory_order_relaxed);
+  if (consumer_seq >= end_unit.load(std::memory_order_acquire)) {
+    update_time_index();
+    return nullptr;
+  }
+  return slot->buffer();
 }
 
-rtl_step_t& trace_buffer_t::pop_front() {
-  size_t cur_head = head;
-  head = (head + 1) % max_entries;
-  return *trace[head];
+void trace_reader_t::pop_buffer() {
+  uint64_t nslots = slots.size();
+  put_buffer(slots[consumer_seq % nslots]->take());
+  consumer_seq++;
+  consumed.store(consumer_seq, std::memory_order_release);
+  admit_waiter.notify();
+  adapt();
+}
+
+void trace_reader_t::start() {
+  printf("trace_reader hart %d: %d decode threads (max %d), depth %d (max %zu), budget %zu MB\n",
+      hartid, active_threads(), nthreads, depth(), slots.size(), mem_budget >> 20);
+  window.start = std::chrono::steady_clock::now();
+  window.consumed = 0;
+  window.consumer_stall_ns = 0;
+  window.producer_stall_ns = 0;
+  window.decode_ns = 0;
+  window.decoded_units = 0;
+  for (int tid = 0; tid < nthreads; ++tid) {
+    threads.emplace_back(std::thread(&trace_reader_t::threadloop, this, tid));
+  }
 }
 
-rtl_step_t& trace_buffer_t::push_back() {
-  assert(!this->full());
+// Memory used by the staging chunks of threads decode threads and by depth
+// decoded buffers
+size_t trace_reader_t::pool_bytes(int threads, int depth) {
+  return (size_t)threads * 2 * (TRACE_CARRY_BYTES + chunk_bytes) +
+         (size_t)depth * per_buff_entries * sizeof(rtl_step_t);
+}
 
-  size_t cur_tail = tail;
-  tail = (tail + 1) % max_entries;
-  return *trace[cur_tail];
+// Gives up depth before threads, but never goes below one thread and a
+// depth of two
+void trace_reader_t::fit_budget(int& threads, int& depth) {
+  while (pool_bytes(threads, depth) > mem_budget) {
+    if (depth > threads + 1)
+      depth--;
+    else if (threads > 1)
+      threads--;
+    else
+      break;
+  }
+  depth = std::max(depth, 2);
 }
 
-// TODO : Bottleneck??
-void trace_buffer_t::generate_trace(int bytes_read) {
-  int i = 0;
-  int digits[] = {0, 10, 16, 10, 10, 10, 10, 10, 16};
-  uint64_t trace_members[] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+// Called by the consumer after every unit. Once per window, sizes the pool
+// from the measured rates of both sides:
+//  - threads: enough decode threads to produce units as fast as the replay
+//    loop consumes them when it is not waiting, plus some headroom
+//  - depth: at least one unit more than there are threads. Grows when the
+//    replay loop still waits although readers sat at the admission gate,
+//    which happens when units take uneven time to decode. Shrinks when the
+//    readers are mostly idle.
+// Both are then trimmed to fit into mem_budget.
+void trace_reader_t::adapt() {
+  auto now = std::chrono::steady_clock::now();
+  uint64_t window_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      now - window.start).count();
+  uint64_t decoded = decoded_units_.load(std::memory_order_relaxed) - window.decoded_units;
+  if (window_ns < TRACE_ADAPT_PERIOD_MS * 1000000ULL || decoded == 0)
+    return;
 
-  while (i < bytes_read) {
-    int index = 0;
-    rtl_step_t& step = this->push_back();
-    char cur_char = (char)buffer[i];
-    while (cur_char != '\n') {
-      uint64_t x = 0;
-      while (cur_char != ' ' && cur_char != '\n') {
-/* printf("cur_char: %c\n", cur_char); */
-        int v = cur_char >= 97 ? cur_char - 87 : cur_char - '0';
-        x = (x * digits[index]) + v;
-        if (i + 1 >= max_file_bytes) {
-          printf("i (%d) + 1 > %lu bytes_read: %d\n", i, max_file_bytes, bytes_read);
-          assert(false);
-        }
-        cur_char = (char)buffer[++i];
-      }
-      trace_members[index++] = x;
-      if (cur_char == ' ')
-        cur_char = (char)buffer[++i];
+  uint64_t units     = consumer_seq - window.consumed;
+  uint64_t cstall    = consumer_stall_ns() - window.consumer_stall_ns;
+  uint64_t pstall    = producer_stall_ns() - window.producer_stall_ns;
+  uint64_t decode_ns = decode_ns_.load(std::memory_order_relaxed) - window.decode_ns;
+
+  int cur_threads = active_threads();
+  int cur_depth = depth();
+  double consume_ns = (double)(window_ns - std::min(cstall, window_ns)) / units;
+  double produce_ns = (double)decode_ns / decoded;
+  bool consumer_stalled = cstall > window_ns / TRACE_ADAPT_STALL_FRAC;
+  bool readers_gated = pstall > cur_threads * window_ns / TRACE_ADAPT_STALL_FRAC;
+  bool readers_idle = pstall > cur_threads * window_ns / 2;
+
+  int threads = (int)std::ceil(produce_ns * 1.25 / std::max(consume_ns, 1.0));
+  if (consumer_stalled && !readers_gated)
+    threads = std::max(threads, cur_threads + 1);
+  threads = std::min(std::max(threads, 1), nthreads);
+
+  int depth = cur_depth;
+  if (consumer_stalled && readers_gated)
+    depth++;
+  else if (!consumer_stalled && readers_idle)
+    depth--;
+  depth = std::min(std::max(depth, threads + 1), (int)slots.size());
+
+  fit_budget(threads, depth);
+
+  if (threads != cur_threads || depth != cur_depth) {
+    printf("trace_reader hart %d: %d decode threads, depth %d "
+        "(decode %.2f ms/unit, replay %.2f ms/unit, consumer stall %.1f%%)\n",
+        hartid, threads, depth, produce_ns / 1e6, consume_ns / 1e6,
+        100.0 * cstall / window_ns);
+    depth_.store(depth, std::memory_order_relaxed);
+    active_threads_.store(threads, std::memory_order_release);
+    max_depth_ = std::max(max_depth_, depth);
+    max_active_threads_ = std::max(max_active_threads_, threads);
+    admit_waiter.notify();
+    park_waiter.notify();
+  }
+
+  window.start = now;
+  window.consumed = consumer_seq;
+  window.consumer_stall_ns += cstall;
+  window.producer_stall_ns += pstall;
+  window.decode_ns += decode_ns;
+  window.decoded_units += decoded;
+}
+
+trace_buffer_t* trace_reader_t::get_buffer() {
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!free_buffers.empty()) {
+      trace_buffer_t* buf = free_buffers.back();
+      free_buffers.pop_back();
+      return buf;
     }
-    i++;
-    step.time    = trace_members[1];
-    step.pc      = trace_members[2];
-    step.val     = trace_members[3];
-    step.except  = trace_members[4];
-    step.intrpt  = trace_members[5];
-    step.has_w   = trace_members[6];
-    step.cause   = trace_members[7];
-    step.wdata   = trace_members[8];
+    nallocated++;
   }
+  return new trace_buffer_t(per_buff_entries, true);
+}
+
+void trace_reader_t::put_buffer(trace_buffer_t* buf) {
   {
-    std::unique_lock<std::mutex> lock(consumable_mutex);
-    consumable = true;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (nallocated <= depth()) {
+      free_buffers.push_back(buf);
+      return;
+    }
+    nallocated--;
   }
+  delete buf;
 }
 
-///////////////////////////////////////////////////////////////////////////////
+bool trace_reader_t::seek(uint64_t time) {
+  assert(threads.empty());
+  seek_time = time;
 
-trace_reader_t::trace_reader_t(int hartid, int nthreads, size_t per_buff_entries, size_t max_file_bytes, std::string trace_dir) {
-  this->trace_dir = trace_dir;
-  this->hartid = hartid;
-  this->consumer_id = 0;
-  this->producer_id = 0;
-  this->trace_id = 0;
-  this->max_file_bytes = max_file_bytes;
-  this->nthreads = nthreads;
-  this->init = true;
-  for (int i = 0; i < nthreads; i++) {
-    this->buffers.push_back(new trace_buffer_t(per_buff_entries, max_file_bytes));
+  std::vector<trace_time_unit_t> units;
+  if (!read_trace_time_index(trace_dir, hartid, units) || units.empty()) {
+    printf("trace_reader hart %d: no time index in %s, decoding from the start\n",
+        hartid, trace_dir.c_str());
+    return false;
   }
+
+  // First unit that ends at or after time. Past the end of the index (which
+  // may have been written before the trace was complete) continue from the
+  // last indexed unit.
+  auto it = std::lower_bound(units.begin(), units.end(), time,
+      [](const trace_time_unit_t& u, uint64_t t) { return u.last_time < t; });
+  if (it == units.end())
+    --it;
+
+  std::lock_guard<std::mutex> lock(buffer_mutex);
+  trace_id = it->file_id;
+  if (!probe_format()) {
+    printf("trace_reader hart %d: file %" PRIu64 " of the time index is missing\n",
+        hartid, it->file_id);
+    trace_id = 0;
+    return false;
+  }
+  cur_file = trace_file(trace_id);
+  cur_file_id = trace_id;
+  if (!read_trace_index(trace_dir + "/" + cur_file, blocks) || blocks.empty())
+    blocks = { { 0, UINT64_MAX, 0, 0 } };
+  next_block = 0;
+  while (next_block < blocks.size() && blocks[next_block].offset != it->offset)
+    next_block++;
+  if (next_block == blocks.size())
+    next_block = 0;
+  trace_id++;
+
+  // The units before the seek point are never decoded
+  from_start = false;
+  printf("trace_reader hart %d: seeking to time %" PRIu64 " at %s block %zu\n",
+      hartid, time, cur_file.c_str(), next_block);
+  return true;
 }
 
-trace_reader_t::~trace_reader_t() {
-  for (auto& b: this->buffers)
-    delete b;
+void trace_reader_t::consumed_time_units(std::vector<trace_time_unit_t>& units) {
+  std::lock_guard<std::mutex> lock(index_mutex);
+  for (uint64_t i = 0; i < consumer_seq && i < time_units.size(); i++) {
+    if (time_units[i].steps != 0)
+      units.push_back(time_units[i]);
+  }
+}
 
-  for (auto& t : threads)
-    t.join();
+bool trace_reader_t::write_time_index() {
+  if (!from_start)
+    return false;
+
+  std::vector<trace_time_unit_t> units;
+  consumed_time_units(units);
+  printf("trace_reader hart %d: writing time index of %zu units\n", hartid, units.size());
+  if (!write_trace_time_index(trace_dir, hartid, units))
+    return false;
+  indexed_units = units.size();
+  return true;
 }
 
-trace_buffer_t* trace_reader_t::cur_buffer() {
-  return buffers[consumer_id];
+// Replaces the time index on disk when it covers fewer units than were
+// consumed, as an index written by a run that stopped earlier does
+void trace_reader_t::update_time_index() {
+  if (!from_start)
+    return;
+
+  std::vector<trace_time_unit_t> units;
+  consumed_time_units(units);
+  if (units.size() <= indexed_units)
+    return;
+  if (!write_time_index())
+    printf("trace_reader hart %d: failed to write %s\n",
+        hartid, trace_time_index_path(trace_dir, hartid).c_str());
 }
 
-void trace_reader_t::pop_buffer() {
+std::string trace_reader_t::trace_file(uint64_t id) {
+  return "COSPIKE-TRACE-" + std::to_string(hartid) + "-" + std::to_string(id) + suffix;
+}
+
+// Picks the trace format and codec from the first trace file. Packed traces
+// are preferred when both a converted and the original trace are present.
+// Must be called with buffer_mutex held.
+bool trace_reader_t::probe_format() {
+  const trace_codec_t codecs[] = {
+    TRACE_CODEC_RAW, TRACE_CODEC_LZ4, TRACE_CODEC_ZSTD, TRACE_CODEC_GZ
+  };
+  std::vector<std::pair<std::string, trace_format_t>> candidates;
+  for (auto c : codecs)
+    candidates.push_back({ std::string(".bin") + trace_codec_suffix(c), TRACE_FMT_PACKED });
+  for (auto c : codecs) {
+    if (c != TRACE_CODEC_RAW)
+      candidates.push_back({ trace_codec_suffix(c), TRACE_FMT_TEXT });
+  }
+  candidates.push_back({ "", TRACE_FMT_TEXT });
+
+  for (auto& c : candidates) {
+    suffix = c.first;
+    if (std::filesystem::exists(trace_dir + "/" + trace_file(trace_id))) {
+      format = c.second;
+      printf("trace_reader hart %d: reading %s traces (*%s, %s)\n",
+          hartid, (format == TRACE_FMT_PACKED) ? "packed" : "text", suffix.c_str(),
+          trace_codec_name(trace_codec_from_path(suffix)));
+      return true;
+    }
+  }
+  suffix = "";
+  return false;
+}
+
+// The pc a hart continues at after a step is only known here when the next
+// step of the unit retires an instruction: the replay loop checks that its pc
+// matches the one of the functional model before stepping it. The other steps,
+// including the last step of every unit, stay TRACE_EVENT_UNKNOWN.
+void trace_reader_t::classify_steps(trace_buffer_t* buf) {
+  rtl_step_t* s = buf->begin();
+  rtl_step_t* end = buf->end();
+  for (; s + 1 < end; s++) {
+    const rtl_step_t& next = s[1];
+    if (next.val && !next.except)
+      s->event = classifier->classify(next.pc);
+  }
+}
+
+chunk_inflater_t::chunk_inflater_t()
+  : dec(nullptr), dst(nullptr), bytes(0), result(0),
+    requested(false), finished(false), stop(false),
+    helper(&chunk_inflater_t::loop, this)
+{
+}
+
+chunk_inflater_t::~chunk_inflater_t() {
   {
-    std::unique_lock<std::mutex> lock(buffer_mutex);
-/* printf("consume done id: %d\n", consumer_id); */
-    consumer_id = (consumer_id + 1) % buffers.size();
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
   }
+  cv.notify_all();
+  helper.join();
 }
 
-void trace_reader_t::start() {
-  const uint32_t num_threads = std::max(
-      std::thread::hardware_concurrency() / 16,
-      std::min(std::thread::hardware_concurrency(), (unsigned int)this->nthreads));
-  for (uint32_t ii = 0; ii < num_threads; ++ii) {
-    threads.emplace_back(std::thread(&trace_reader_t::threadloop, this));
+void chunk_inflater_t::start(trace_decoder_t* dec, uint8_t* dst, size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->dec = dec;
+    this->dst = dst;
+    this->bytes = bytes;
+    requested = true;
+    finished = false;
   }
+  cv.notify_all();
+}
+
+int chunk_inflater_t::finish() {
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [this] { return finished; });
+  return result;
 }
 
-void trace_reader_t::threadloop() {
+void chunk_inflater_t::loop() {
+  std::unique_lock<std::mutex> lock(mutex);
   while (true) {
-    int pid = -1;
+    cv.wait(lock, [this] { return requested || stop; });
+    if (!requested)
+      return;
+
+    requested = false;
+    lock.unlock();
+    int ret = dec->read(dst, bytes);
+    lock.lock();
+    result = ret;
+    finished = true;
+    cv.notify_all();
+  }
+}
+
+// Decompresses the trace file chunk by chunk and parses chunk k while chunk k+1
+// is being decompressed by the inflater of the reader thread. Each staging buffer keeps TRACE_CARRY_BYTES of headroom
+// in front of the decompressed data, where the partial line (or packed record)
+// left over at the end of the previous chunk is copied.
+void trace_reader_t::decode_file(const std::string& path,
+                                 const trace_block_t& blk,
+                                 trace_buffer_t* tbuf,
+                                 std::vector<uint8_t>* stage,
+                                 chunk_inflater_t& inflater)
+{
+  tbuf->clear();
+  trace_decoder_t* dec = open_trace_decoder(path, blk.offset, blk.bytes);
+  if (dec == nullptr) {
+    printf("trace_reader hart %d: failed to open %s\n", hartid, path.c_str());
+    return;
+  }
+
+  static cospike_parser_t text_parser = cospike_parser();
+  packed_trace_state_t st = {};
+  auto parse = [&](const uint8_t* buf, size_t bytes) -> size_t {
+    if (format == TRACE_FMT_TEXT)
+      return text_parser(buf, bytes, tbuf);
+    else
+      return packed_trace_decode(buf, bytes, st, tbuf);
+  };
+  uint8_t* cur = stage[0].data() + TRACE_CARRY_BYTES;
+  uint8_t* nxt = stage[1].data() + TRACE_CARRY_BYTES;
+  size_t carry = 0;
+  int bytes_read = dec->read(cur, chunk_bytes);
+  while (bytes_read > 0) {
+    // The decoder never touches the headroom of nxt, so the carry can be copied
+    // there while the next chunk is being decompressed
+    inflater.start(dec, nxt, chunk_bytes);
+
+    const uint8_t* start = cur - carry;
+    size_t avail = carry + (size_t)bytes_read;
+    size_t used = parse(start, avail);
+    carry = avail - used;
+    if (carry > TRACE_CARRY_BYTES) {
+      printf("trace_reader hart %d: %zu bytes without a complete step in %s\n",
+          hartid, carry, path.c_str());
+      assert(false);
+    }
+    memcpy(nxt - carry, start + used, carry);
+
+    bytes_read = inflater.finish();
+    std::swap(cur, nxt);
+  }
+  if (bytes_read < 0) {
+    printf("trace_reader hart %d: failed to decompress %s: %s\n",
+        hartid, path.c_str(), dec->error().c_str());
+  }
+  if (carry != 0) {
+    printf("trace_reader hart %d: dropping %zu trailing bytes of %s\n",
+        hartid, carry, path.c_str());
+  }
+  delete dec;
+}
+
+void trace_reader_t::threadloop(int tid) {
+  // Per thread staging memory, independent of the trace file size
+  std::vector<uint8_t> stage[2];
+  chunk_inflater_t inflater;
+
+  while (!should_terminate) {
+    if (tid >= active_threads_.load(std::memory_order_acquire)) {
+      // Parked threads give their staging memory back
+      for (auto& s : stage)
+        std::vector<uint8_t>().swap(s);
+      park_waiter.wait([this, tid] {
+          return tid < active_threads_.load(std::memory_order_acquire) ||
+                 should_terminate.load(std::memory_order_relaxed);
+          });
+      continue;
+    }
+    if (stage[0].empty()) {
+      for (auto& s : stage)
+        s.resize(TRACE_CARRY_BYTES + chunk_bytes);
+    }
+
+    bool claimed = false;
+    uint64_t seq = 0;
+    uint64_t file_id = 0;
     std::string file;
+    trace_block_t blk;
     {
       std::unique_lock<std::mutex> lock(buffer_mutex);
-      file = "COSPIKE-TRACE-" +
-             std::to_string(hartid) + "-" +
-             std::to_string(trace_id) + ".gz";
-      const std::filesystem::path path{trace_dir + "/" + file};
-      bool has_file = std::filesystem::exists(path);
-/* printf("trace_dir: %s file: %s has_file: %d\n", trace_dir.c_str(), file.c_str(), has_file); */
-      if (has_file) {
-        trace_buffer_t* cbuf = buffers[consumer_id];
-        if ((producer_id != consumer_id || init)) {
-/* printf("start decompressing trace: %d producer id: %d\n", trace_id, producer_id); */
-          this->init = false;
-          trace_id++;
-          pid = producer_id;
-          producer_id = (producer_id + 1) % buffers.size();
+
+      // Move on to the next file once every block of the current one has
+      // been handed out. Only the thread holding buffer_mutex waits for it,
+      // the others sleep on the mutex.
+      if (next_block == blocks.size()) {
+        if (end_unit.load(std::memory_order_relaxed) != UINT64_MAX)
+          break;
+
+        auto status = watcher->wait_for(trace_id, should_terminate);
+        if (status == trace_watcher_t::TRACE_FILE_TERMINATED)
+          break;
+        if (status == trace_watcher_t::TRACE_FILE_END) {
+          printf("trace_reader hart %d: end of trace after %" PRIu64 " files\n", hartid, trace_id);
+          end_unit.store(unit_id, std::memory_order_release);
+          for (auto& s : slots)
+            s->wakeup();
+          break;
         }
+        if (format == TRACE_FMT_UNKNOWN && !probe_format()) {
+          printf("trace_reader hart %d: unknown trace format in %s\n", hartid, trace_dir.c_str());
+          assert(false);
+        }
+
+        cur_file = trace_file(trace_id);
+        cur_file_id = trace_id;
+        std::string path = trace_dir + "/" + cur_file;
+        next_block = 0;
+        if (!read_trace_index(path, blocks) || blocks.empty())
+          blocks = { { 0, UINT64_MAX, 0, 0 } };
+        trace_id++;
+      }
+      if (next_block < blocks.size()) {
+        claimed = true;
+        file = cur_file;
+        file_id = cur_file_id;
+        blk = blocks[next_block++];
+        seq = unit_id++;
       }
     }
-    if (pid >= 0) {
-      std::string path = trace_dir + "/" + file;
-      trace_buffer_t* pbuf = buffers[pid];
-      gzFile fp = gzopen(path.c_str(), "r");
-      int bytes_read = gzread(fp, pbuf->get_buffer(), this->max_file_bytes);
-      pbuf->generate_trace(bytes_read);
+    if (claimed) {
+      uint64_t stall = admit_waiter.wait([this, seq] {
+          return seq < consumed.load(std::memory_order_acquire) +
+                       (uint64_t)depth_.load(std::memory_order_relaxed) ||
+                 should_terminate.load(std::memory_order_relaxed);
+          });
+      producer_stall_ns_.fetch_add(stall, std::memory_order_relaxed);
+      if (should_terminate)
+        break;
+
+      trace_buffer_t* pbuf = get_buffer();
+      auto start = std::chrono::steady_clock::now();
+      decode_file(trace_dir + "/" + file, blk, pbuf, stage, inflater);
+      auto end = std::chrono::steady_clock::now();
+      decode_ns_.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            end - start).count(), std::memory_order_relaxed);
+      decoded_units_.fetch_add(1, std::memory_order_relaxed);
+      bubbles_.fetch_add(pbuf->bubbles(), std::memory_order_relaxed);
+      if (classifier != nullptr)
+        classify_steps(pbuf);
+
+      if (from_start) {
+        trace_time_unit_t u = { file_id, blk.offset, blk.bytes, 0, 0, pbuf->size() };
+        if (!pbuf->empty()) {
+          u.first_time = pbuf->begin()->time;
+          u.last_time = (pbuf->end() - 1)->time;
+        }
+        std::lock_guard<std::mutex> lock(index_mutex);
+        if (time_units.size() <= seq)
+          time_units.resize(seq + 1);
+        time_units[seq] = u;
+      }
+      // Times only increase within a unit, so this only touches a prefix of
+      // the unit that contains seek_time
+      while (!pbuf->empty() && pbuf->begin()->time < seek_time)
+        pbuf->pop_front();
+
+      uint64_t nslots = slots.size();
+      slots[seq % nslots]->publish(seq / nslots, pbuf);
     }
   }
 }
@@ -2,62 +2,317 @@
 #define __TRACE_READER_H__
 
 #include "trace.h"
+#include "handoff.h"
+#include "trace_index.h"
+#include "trace_watcher.h"
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <string>
+#include <chrono>
 #include <inttypes.h>
+#include <assert.h>
 
+// Trace files are decompressed in chunks of chunk_bytes (clamped to these bounds)
+#define TRACE_MIN_CHUNK_BYTES (64 * 1024)
+#define TRACE_MAX_CHUNK_BYTES (256 * 1024 * 1024)
+#define TRACE_DEFAULT_CHUNK_BYTES (4 * 1024 * 1024)
+
+// Longest partial line or packed record carried from one chunk to the next
+#define TRACE_CARRY_BYTES 4096
+
+enum trace_format_t {
+  TRACE_FMT_UNKNOWN,
+  TRACE_FMT_TEXT,   // COSPIKE-TRACE-<hart>-<n>[.gz|.zst|.lz4]
+  TRACE_FMT_PACKED  // COSPIKE-TRACE-<hart>-<n>.bin[.gz|.zst|.lz4], see trace_packed.h
+};
+
+#define TRACE_BUFFER_ALIGN 64
+
+// Default bound on the memory held by decoded buffers and staging chunks
+#define TRACE_READER_MEM_BUDGET (2ULL * 1024 * 1024 * 1024)
+
+// Upper bound on the number of work units decoded ahead of the replay loop
+#define TRACE_MAX_DEPTH 64
+
+// The pool is resized once per window of at least TRACE_ADAPT_PERIOD_MS
+#define TRACE_ADAPT_PERIOD_MS 200
+
+// Stalling for more than 1/TRACE_ADAPT_STALL_FRAC of a window counts as a stall
+#define TRACE_ADAPT_STALL_FRAC 20
+
+// Decoded steps of one work unit (a whole trace file, or one block of a
+// blocked trace file). Buffers are owned by the reader's pool and lent to one
+// reader thread and then to the replay loop at a time.
 class trace_buffer_t {
 public:
-  trace_buffer_t(size_t max_entries, size_t max_file_bytes);
+  // With filter_bubbles set, the parsers drop bubbles instead of storing them
+  // and count them in the idle field of the next step that is kept
+  trace_buffer_t(size_t max_entries, bool filter_bubbles = false);
   ~trace_buffer_t();
 
-  bool empty();
-  bool full();
-  bool can_consume();
-  void done_consume();
-  uint8_t* get_buffer();
-  rtl_step_t& pop_front();
-  rtl_step_t& push_back();
-  void generate_trace(int bytes_read);
+  // Steps that have not been consumed yet, stored contiguously
+  rtl_step_t* begin() { return steps + head; }
+  rtl_step_t* end()   { return steps + tail; }
+  size_t size()       { return tail - head; }
+  bool empty()        { return head == tail; }
+  bool full()         { return tail == max_entries; }
+
+  rtl_step_t& pop_front() {
+    assert(!empty());
+    return steps[head++];
+  }
+
+  rtl_step_t& push_back() {
+    assert(!full());
+    rtl_step_t& step = steps[tail++];
+    step.idle = idle;
+    step.event = TRACE_EVENT_UNKNOWN;
+    idle = 0;
+    return step;
+  }
+
+  // Called by the parsers before push_back. Returns true if the step is a
+  // bubble that is dropped. Once idle is full the bubble is kept as a step
+  // of its own that carries the count, so that idle stays exact.
+  bool drop_bubble(bool val, bool except, bool intrpt) {
+    if (!filter_bubbles || val || except || intrpt || idle == UINT16_MAX)
+      return false;
+    nbubbles++;
+    idle++;
+    return true;
+  }
+
+  // Bubbles dropped since the last clear()
+  uint64_t bubbles() { return nbubbles; }
+
+  // Drops all steps, making the whole capacity available to push_back again
+  void clear() {
+    head = tail = 0;
+    idle = 0;
+    nbubbles = 0;
+  }
 
 private:
-  size_t max_file_bytes;
   size_t max_entries;
   size_t head;
   size_t tail;
-  std::mutex consumable_mutex;
-  bool consumable;
-  std::vector<rtl_step_t*> trace;
-  uint8_t* buffer;
+  rtl_step_t* steps;
+
+  bool filter_bubbles;
+  uint16_t idle;
+  uint64_t nbubbles;
+};
+
+// Handoff point of work unit k between a reader thread and the replay loop.
+// Unit k goes through slots[k % nslots], and the generation (k / nslots)
+// tells the consumer whether the unit in the slot is the one it is waiting
+// for: generation g is ready once published == g + 1. Readers never get more
+// than depth <= nslots units ahead of the consumer (see trace_reader_t), so
+// a slot is always drained before it is reused.
+class trace_slot_t {
+public:
+  trace_slot_t() : buf(nullptr), published(0) {}
+
+  // Producer side
+  void publish(uint64_t gen, trace_buffer_t* buf);
+
+  // Consumer side, also returns once unit seq is past the end of the trace
+  uint64_t wait_until_published(uint64_t gen, uint64_t seq, std::atomic<uint64_t>& end_seq);
+  trace_buffer_t* buffer() { return buf; }
+  // Hands the buffer of a drained unit back, leaving the slot empty
+  trace_buffer_t* take();
+
+  void wakeup() { waiter.notify(); }
+
+private:
+  trace_buffer_t* buf;
+  std::atomic<uint64_t> published;
+  handoff_waiter_t waiter;
+};
+
+// Maps a pc to its hook event (TRACE_EVENT_*). Called concurrently by the
+// reader threads, so the set of hooked pcs must not change once the reader
+// has started.
+class trace_classifier_t {
+public:
+  virtual ~trace_classifier_t() {}
+  virtual uint8_t classify(uint64_t pc) const = 0;
+};
+
+class trace_decoder_t;
+
+// Helper thread of one reader thread. It inflates chunk k + 1 of the unit
+// being decoded while the reader thread parses chunk k, and lives as long as
+// the reader thread so that no thread is created per chunk. A chunk takes
+// far longer than a wakeup, so both sides sleep instead of spinning.
+class chunk_inflater_t {
+public:
+  chunk_inflater_t();
+  ~chunk_inflater_t();
+
+  // Starts dec->read(dst, bytes) on the helper thread
+  void start(trace_decoder_t* dec, uint8_t* dst, size_t bytes);
+
+  // Waits for the read started last and returns its result
+  int finish();
+
+private:
+  void loop();
+
+  trace_decoder_t* dec;
+  uint8_t* dst;
+  size_t bytes;
+  int result;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool requested;
+  bool finished;
+  bool stop;
+  std::thread helper;
 };
 
 class trace_reader_t {
 public:
-  trace_reader_t(int hartid, int nthreads, size_t per_buff_entries, size_t max_file_bytes, std::string trace_dir);
+  // nthreads bounds the number of decode threads (0 for one per hardware
+  // thread). How many of them run and how many units are decoded ahead of
+  // the replay loop is adjusted at runtime so that the replay loop does not
+  // wait on the readers, while keeping the buffers and staging chunks within
+  // mem_budget bytes.
+  trace_reader_t(int hartid, int nthreads, size_t per_buff_entries, size_t chunk_bytes, std::string trace_dir,
+                 size_t mem_budget = TRACE_READER_MEM_BUDGET);
   ~trace_reader_t();
 
+  // Blocks until the next trace file (or block) has been decoded.
+  // Returns nullptr after the last one once COSPIKE-TRACE-<hart>-DONE exists.
   trace_buffer_t* cur_buffer();
   void pop_buffer();
   void start();
 
+  // Starts decoding at the unit of the time index (trace_index.h) that covers
+  // time instead of at file 0, and drops the steps before time. Must be called
+  // before start(). Without a time index the trace is decoded from the start
+  // and only the steps are dropped, in which case false is returned.
+  bool seek(uint64_t time);
+
+  // Writes the time index of the units consumed so far. Only possible when
+  // the trace was read from the start, in which case the index is also
+  // written at the end of the trace and when the reader is destroyed, unless
+  // the index on disk already covers as many units.
+  bool write_time_index();
+
+  // Makes the reader threads tag every decoded step with the event of the pc
+  // the hart continues at. Must be called before start(). Without a
+  // classifier every step is tagged TRACE_EVENT_UNKNOWN.
+  void set_classifier(const trace_classifier_t* classifier) { this->classifier = classifier; }
+
+  // Time the replay loop spent waiting on the readers
+  uint64_t consumer_stall_ns() { return consumer_stall_ns_.load(std::memory_order_relaxed); }
+  // Time the readers spent waiting on the replay loop, summed over threads
+  uint64_t producer_stall_ns() { return producer_stall_ns_.load(std::memory_order_relaxed); }
+
+  // Current and largest number of units decoded ahead of the replay loop
+  int depth()     { return depth_.load(std::memory_order_relaxed); }
+  int max_depth() { return max_depth_; }
+  // Current and largest number of decode threads that are not parked
+  int active_threads()     { return active_threads_.load(std::memory_order_relaxed); }
+  int max_active_threads() { return max_active_threads_; }
+
+  // Bubbles dropped by the readers, which never reach the consumer
+  uint64_t bubbles() { return bubbles_.load(std::memory_order_relaxed); }
+
 private:
-  void threadloop();
+  void threadloop(int tid);
+  void adapt();
+  void classify_steps(trace_buffer_t* buf);
+  size_t pool_bytes(int threads, int depth);
+  void fit_budget(int& threads, int& depth);
+  trace_buffer_t* get_buffer();
+  void put_buffer(trace_buffer_t* buf);
+  bool probe_format();
+  std::string trace_file(uint64_t id);
+  void consumed_time_units(std::vector<trace_time_unit_t>& units);
+  void update_time_index();
+  void decode_file(const std::string& path,
+                   const trace_block_t& blk,
+                   trace_buffer_t* tbuf,
+                   std::vector<uint8_t>* stage,
+                   chunk_inflater_t& inflater);
 
   std::string trace_dir;
   int hartid;
-  int consumer_id;
-  int producer_id;
+  uint64_t consumer_seq;
   uint64_t trace_id;
-  std::vector<trace_buffer_t*> buffers;
-  size_t max_file_bytes;
+  uint64_t unit_id;
+  trace_format_t format;
+  std::string suffix;
+
+  // Blocks of the file that is currently being handed out
+  std::string cur_file;
+  uint64_t cur_file_id;
+  std::vector<trace_block_t> blocks;
+  size_t next_block;
+
+  trace_watcher_t* watcher;
+  std::atomic<uint64_t> end_unit;
+
+  const trace_classifier_t* classifier;
+
+  // Steps before seek_time are dropped by the readers
+  uint64_t seek_time;
+
+  // Time range of every unit by unit id, recorded for the time index when
+  // the trace is read from the start
+  bool from_start;
+  uint64_t indexed_units;
+  std::mutex index_mutex;
+  std::vector<trace_time_unit_t> time_units;
 
-  bool init;
+  std::vector<trace_slot_t*> slots;
+  size_t chunk_bytes;
+  size_t per_buff_entries;
+  size_t mem_budget;
+
+  // Readers may decode unit k once k < consumed + depth
+  std::atomic<uint64_t> consumed;
+  std::atomic<int> depth_;
+  handoff_waiter_t admit_waiter;
+
+  // Buffers that are not lent out. Buffers above depth are freed when they
+  // come back so that shrinking the depth gives the memory back.
+  std::mutex pool_mutex;
+  std::vector<trace_buffer_t*> free_buffers;
+  int nallocated;
+
+  // Threads with tid >= active_threads_ park on park_waiter
   int nthreads;
+  std::atomic<int> active_threads_;
+  handoff_waiter_t park_waiter;
+
   std::mutex buffer_mutex;
   std::vector<std::thread> threads;
+  std::atomic<bool> should_terminate;
+
+  std::atomic<uint64_t> consumer_stall_ns_;
+  std::atomic<uint64_t> producer_stall_ns_;
+  std::atomic<uint64_t> decode_ns_;
+  std::atomic<uint64_t> decoded_units_;
+  std::atomic<uint64_t> bubbles_;
+
+  // Counters at the start of the current adaptation window
+  struct {
+    std::chrono::steady_clock::time_point start;
+    uint64_t consumed;
+    uint64_t consumer_stall_ns;
+    uint64_t producer_stall_ns;
+    uint64_t decode_ns;
+    uint64_t decoded_units;
+  } window;
+  int max_depth_;
+  int max_active_threads_;
 };
 
 #endif // __TRACE_READER_H__
@@ -0,0 +1,156 @@
+
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <filesystem>
+#include "trace_watcher.h"
+
+trace_watcher_t::trace_watcher_t(const std::string& dir, int hartid)
+  : dir(dir), prefix("COSPIKE-TRACE-" + std::to_string(hartid) + "-"), done(false), stop(false)
+{
+  // Register the watch before the initial scan so that no file falls
+  // in between the two
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  int err = errno;
+  if (inotify_fd >= 0 &&
+      inotify_add_watch(inotify_fd, dir.c_str(), IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    err = errno;
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  if (inotify_fd < 0)
+    printf("trace_watcher: inotify unavailable for %s (%s), polling instead\n",
+        dir.c_str(), strerror(err));
+
+  scan(true);
+  watcher = std::thread(&trace_watcher_t::watchloop, this);
+}
+
+trace_watcher_t::~trace_watcher_t() {
+  stop = true;
+  watcher.join();
+  if (inotify_fd >= 0)
+    close(inotify_fd);
+}
+
+trace_watcher_t::status_t trace_watcher_t::wait_for(uint64_t n, std::atomic<bool>& terminate) {
+  std::unique_lock<std::mutex> lock(mutex);
+  status_t status = TRACE_FILE_TERMINATED;
+  cv.wait(lock, [&] {
+      if (terminate) {
+        status = TRACE_FILE_TERMINATED;
+        return true;
+      }
+      bool has_file = seen.count(n) != 0;
+      if (has_file && (complete.count(n) || done)) {
+        status = TRACE_FILE_READY;
+        return true;
+      }
+      if (!has_file && done) {
+        status = TRACE_FILE_END;
+        return true;
+      }
+      return false;
+      });
+  return status;
+}
+
+void trace_watcher_t::wakeup() {
+  { std::lock_guard<std::mutex> lock(mutex); }
+  cv.notify_all();
+}
+
+// Must be called with mutex held. Returns true if the state changed.
+bool trace_watcher_t::handle_name(const std::string& name, bool closed) {
+  if (name.compare(0, prefix.size(), prefix) != 0)
+    return false;
+
+  std::string rest = name.substr(prefix.size());
+  if (rest == "DONE") {
+    bool changed = !done;
+    done = true;
+    return changed;
+  }
+
+  // Block indices and partially written blocked traces are not trace files
+  std::filesystem::path p(rest);
+  if (p.extension() == ".idx" || p.extension() == ".tmp")
+    return false;
+
+  char* end;
+  uint64_t n = strtoull(rest.c_str(), &end, 10);
+  if (end == rest.c_str())
+    return false;
+
+  bool changed = (seen.count(n) == 0);
+  seen[n] = name;
+  if (closed && complete.insert(n).second)
+    changed = true;
+  return changed;
+}
+
+// True unless some process has path open for writing. A read lease is
+// refused with EAGAIN exactly in that case, see fcntl(2). Files a lease can
+// not be taken on for another reason (not the owner, NFS) count as closed.
+static bool closed_for_writing(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return true;
+  bool closed = true;
+  if (fcntl(fd, F_SETLEASE, F_RDLCK) == 0)
+    fcntl(fd, F_SETLEASE, F_UNLCK);
+  else
+    closed = (errno != EAGAIN);
+  close(fd);
+  return closed;
+}
+
+// The startup scan also marks the files that were closed before the watcher
+// started, later ones only note new names for the polling fallback. Files
+// closed after the inotify watch was added are reported by inotify as well.
+void trace_watcher_t::scan(bool startup) {
+  std::error_code ec;
+  bool changed = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+      std::string name = entry.path().filename().string();
+      changed |= handle_name(name, startup && closed_for_writing(entry.path().string()));
+    }
+  }
+  if (changed)
+    cv.notify_all();
+}
+
+void trace_watcher_t::watchloop() {
+  alignas(struct inotify_event) char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+  while (!stop) {
+    bool changed = false;
+    if (inotify_fd >= 0) {
+      struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+      if (poll(&pfd, 1, TRACE_WATCH_POLL_MS) > 0) {
+        ssize_t len;
+        while ((len = read(inotify_fd, events, sizeof(events))) > 0) {
+          std::lock_guard<std::mutex> lock(mutex);
+          for (char* p = events; p < events + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->len > 0)
+              changed |= handle_name(ev->name, ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO));
+            p += sizeof(struct inotify_event) + ev->len;
+          }
+        }
+      }
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_WATCH_POLL_MS));
+      scan(false);
+    }
+    if (changed)
+      cv.notify_all();
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef __TRACE_WATCHER_H__
+#define __TRACE_WATCHER_H__
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <condition_variable>
+#include <inttypes.h>
+
+// Period of the fallback directory scan
+#define TRACE_WATCH_POLL_MS 50
+
+// Tracks which COSPIKE-TRACE-<hart>-<n>* files are completely written so
+// that reader threads can sleep instead of polling the filesystem.
+// Trace file n is complete once any of these holds:
+//  - it was closed after being opened for writing (or renamed into place)
+//  - it existed when the watcher started and nobody had it open for writing
+//  - COSPIKE-TRACE-<hart>-DONE exists, which marks the end of the trace
+// Directory changes come from inotify. When inotify is not available the
+// directory is rescanned every TRACE_WATCH_POLL_MS instead, and files
+// written after the start only complete with the DONE marker.
+class trace_watcher_t {
+public:
+  enum status_t {
+    TRACE_FILE_READY,
+    TRACE_FILE_END,       // The DONE marker exists and file n was never written
+    TRACE_FILE_TERMINATED
+  };
+
+  trace_watcher_t(const std::string& dir, int hartid);
+  ~trace_watcher_t();
+
+  // Blocks until trace file n is complete, the trace has ended or
+  // terminate is set (followed by a call to wakeup)
+  status_t wait_for(uint64_t n, std::atomic<bool>& terminate);
+  void wakeup();
+
+private:
+  void watchloop();
+  void scan(bool startup);
+  bool handle_name(const std::string& name, bool closed);
+
+  std::string dir;
+  std::string prefix;
+  int inotify_fd;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::map<uint64_t, std::string> seen;
+  std::set<uint64_t> complete;
+  bool done;
+
+  std::atomic<bool> stop;
+  std::thread watcher;
+};
+
+#endif // __TRACE_WATCHER_H__
@@ -34,6 +34,13 @@ function_t::function_t(std::string name)
 {
 }
 
+opt_cs_entry_t function_t::update_profiler(profiler_t* p) {
+  // The profiler runs a single hart
+  hook_args_t args = {};
+  capture(p, p->get_core(0), args);
+  return update(p, args);
+}
+
 
 kernel_function_t::kernel_function_t(std::string name)
   : function_t(name)
@@ -60,20 +67,20 @@ kf_do_execveat_common::kf_do_execveat_common(std::string name)
 {
 }
 
-opt_cs_entry_t kf_do_execveat_common::update_profiler(profiler_t* p) {
-  // TODO : multicore support
-  processor_lib_t* proc = p->get_core(0);
-  reg_t pid = get_current_pid(proc);
-  std::string filepath = find_exec_syscall_filepath(p, proc);
+void kf_do_execveat_common::capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) {
+  args.cur_pid = get_current_pid(proc);
+  args.path = find_exec_syscall_filepath(p, proc);
+}
 
-  p->pstate()->update_pid2bin(pid, filepath);
+opt_cs_entry_t kf_do_execveat_common::update(profiler_t* p, const hook_args_t& args) {
+  p->pstate()->update_pid2bin(args.cur_pid, args.path);
   p->logger()->submit_packet(new perfetto::trackevent_packet_t(
         std::string(k_do_execveat_common),
         perfetto::TYPE_INSTANT,
         p->PROF_PERFETTO_TRACKID_BASE,
         p->pstate()->get_timestamp()));
 
-  return callstack_entry_t(k_do_execveat_common, filepath);
+  return callstack_entry_t(k_do_execveat_common, args.path);
 }
 
 std::string kf_do_execveat_common::find_exec_syscall_filepath(
@@ -109,15 +116,19 @@ kf_set_mm_asid::kf_set_mm_asid(std::string name)
 {
 }
 
-opt_cs_entry_t kf_set_mm_asid::update_profiler(profiler_t* p) {
-  processor_lib_t* proc = p->get_core(0);
-  reg_t pid = get_current_pid(proc);
+void kf_set_mm_asid::capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) {
+  args.cur_pid = get_current_pid(proc);
+  args.asid = proc->get_asid();
+}
+
+opt_cs_entry_t kf_set_mm_asid::update(profiler_t* p, const hook_args_t& args) {
+  reg_t pid = args.cur_pid;
   std::vector<callstack_entry_t>& cs = p->pstate()->get_callstack(pid);
 
   if (called_by_do_execveat_common(cs)) {
     callstack_entry_t top = cs.back();
     std::string bin = top.bin();
-    reg_t asid = proc->get_asid();
+    reg_t asid = args.asid;
 
     pprintf("Found mapping ASID: %" PRIu64 " PID: %u bin: %s\n",
         asid, pid, bin.c_str());
@@ -151,10 +162,14 @@ kf_kernel_clone::kf_kernel_clone(std::string name)
 {
 }
 
-opt_cs_entry_t kf_kernel_clone::update_profiler(profiler_t* p) {
-  processor_lib_t* proc = p->get_core(0);
-  pid_t newpid = get_forked_task_pid(p, proc);
-  pid_t parpid = get_current_pid(proc);
+void kf_kernel_clone::capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) {
+  args.task_pid = get_forked_task_pid(p, proc);
+  args.cur_pid = get_current_pid(proc);
+}
+
+opt_cs_entry_t kf_kernel_clone::update(profiler_t* p, const hook_args_t& args) {
+  pid_t newpid = args.task_pid;
+  pid_t parpid = args.cur_pid;
 
   auto opt_bin = p->pstate()->pid2bin_lookup(parpid);
   std::string new_task_name;
@@ -193,13 +208,21 @@ kf_pick_next_task_fair::kf_pick_next_task_fair(std::string name)
 {
 }
 
-opt_cs_entry_t kf_pick_next_task_fair::update_profiler(profiler_t* p) {
-  processor_lib_t* proc = p->get_core(0);
-  get_pid_next_task(p, proc);
+void kf_pick_next_task_fair::capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) {
+  args.task_pid = get_pid_next_task(p, proc);
+}
+
+opt_cs_entry_t kf_pick_next_task_fair::update(profiler_t* p, const hook_args_t& args) {
+  // TODO : Add metadata which indicates whether CFS was able to choose a task or  not
+  p->logger()->submit_packet(new perfetto::trackevent_packet_t(
+        std::string(k_pick_next_task_fair),
+        perfetto::TYPE_INSTANT,
+        p->PROF_PERFETTO_TRACKID_BASE,
+        p->pstate()->get_timestamp()));
   return {};
 }
 
-void kf_pick_next_task_fair::get_pid_next_task(profiler_t *p, processor_lib_t* proc) {
+pid_t kf_pick_next_task_fair::get_pid_next_task(profiler_t *p, processor_lib_t* proc) {
   objdump_parser_t *obj = p->get_objdump_parser(profiler::KERNEL);
   std::string ret_reg = obj->func_ret_reg(k_pick_next_task_fair);
   unsigned int reg_idx = riscv_abi_ireg[ret_reg];
@@ -209,17 +232,10 @@ void kf_pick_next_task_fair::get_pid_next_task(profiler_t *p, processor_lib_t* p
   addr_t next_task_ptr = state->XPR[reg_idx];
   if (next_task_ptr == 0) {
     pprintf("CFS doesn't have a task to schedule, ret_reg: %s\n", ret_reg.c_str());
-  } else {
-    addr_t next_task_pid_addr = next_task_ptr + offsetof_task_struct_pid;
-    pid_t pid = mmu->load<pid_t>(next_task_pid_addr);
+    return -1;
   }
-
-  // TODO : Add metadata which indicates whether CFS was able to choose a task or  not
-  p->logger()->submit_packet(new perfetto::trackevent_packet_t(
-        std::string(k_pick_next_task_fair),
-        perfetto::TYPE_INSTANT,
-        p->PROF_PERFETTO_TRACKID_BASE,
-        p->pstate()->get_timestamp()));
+  addr_t next_task_pid_addr = next_task_ptr + offsetof_task_struct_pid;
+  return mmu->load<pid_t>(next_task_pid_addr);
 }
 
 kf_finish_task_switch::kf_finish_task_switch(std::string name)
@@ -227,10 +243,14 @@ kf_finish_task_switch::kf_finish_task_switch(std::string name)
 {
 }
 
-opt_cs_entry_t kf_finish_task_switch::update_profiler(profiler_t* p) {
-  processor_lib_t* proc = p->get_core(0);
-  pid_t cur_pid  = get_current_pid(proc);
-  pid_t prev_pid = get_prev_pid(p, proc);
+void kf_finish_task_switch::capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) {
+  args.cur_pid = get_current_pid(proc);
+  args.task_pid = get_prev_pid(p, proc);
+}
+
+opt_cs_entry_t kf_finish_task_switch::update(profiler_t* p, const hook_args_t& args) {
+  pid_t cur_pid  = args.cur_pid;
+  pid_t prev_pid = args.task_pid;
   p->pstate()->set_curpid(cur_pid);
 
   pprintf("ContextSwitch Finished %u -> %u\n", prev_pid, cur_pid);
@@ -28,6 +28,14 @@ private:
 
 typedef std::optional<callstack_entry_t> opt_cs_entry_t;
 
+// What a hook reads from the hart when it fires. During trace replay the
+// hart has moved on by the time the analysis thread runs update().
+struct hook_args_t {
+  reg_t asid;
+  pid_t cur_pid;      // task running on the hart
+  pid_t task_pid;     // task passed to or returned by the function
+  std::string path;   // file executed by do_execveat_common
+};
 
 class function_t {
 public:
@@ -35,8 +43,15 @@ public:
 
   std::string name() { return n; }
 
-  // when called, updates the profiler state under the hood
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) = 0;
+  // Reads what update() needs from the hart. Must not touch the profiler
+  // state or the logger, which belong to the thread running update().
+  virtual void capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) = 0;
+
+  // Updates the profiler state from what capture() read
+  virtual opt_cs_entry_t update(profiler_t* p, const hook_args_t& args) = 0;
+
+  // capture() and update() at once, on core 0
+  opt_cs_entry_t update_profiler(profiler_t* p);
 
 private:
   const std::string n;
@@ -45,7 +60,6 @@ private:
 class kernel_function_t : public function_t {
 public:
   kernel_function_t(std::string name);
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) = 0;
 
 protected:
   addr_t get_current_ptr(processor_lib_t* proc);
@@ -56,7 +70,8 @@ protected:
 class kf_do_execveat_common : public kernel_function_t {
 public:
   kf_do_execveat_common(std::string name);
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) override;
+  virtual void capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) override;
+  virtual opt_cs_entry_t update(profiler_t* p, const hook_args_t& args) override;
 
 private:
   std::string find_exec_syscall_filepath(profiler_t *p, processor_lib_t *proc);
@@ -68,7 +83,8 @@ private:
 class kf_set_mm_asid : public kernel_function_t {
 public:
   kf_set_mm_asid(std::string name);
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) override;
+  virtual void capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) override;
+  virtual opt_cs_entry_t update(profiler_t* p, const hook_args_t& args) override;
 
 private:
   bool called_by_do_execveat_common(std::vector<callstack_entry_t>& cs);
@@ -77,7 +93,8 @@ private:
 class kf_kernel_clone : public kernel_function_t {
 public:
   kf_kernel_clone(std::string name);
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) override;
+  virtual void capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) override;
+  virtual opt_cs_entry_t update(profiler_t* p, const hook_args_t& args) override;
 
 private:
   pid_t get_forked_task_pid(profiler_t* p, processor_lib_t* proc);
@@ -86,16 +103,18 @@ private:
 class kf_pick_next_task_fair : public kernel_function_t {
 public:
   kf_pick_next_task_fair(std::string name);
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) override;
+  virtual void capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) override;
+  virtual opt_cs_entry_t update(profiler_t* p, const hook_args_t& args) override;
 
 private:
-  void get_pid_next_task(profiler_t *p, processor_lib_t* proc);
+  pid_t get_pid_next_task(profiler_t *p, processor_lib_t* proc);
 };
 
 class kf_finish_task_switch : public kernel_function_t {
 public:
   kf_finish_task_switch(std::string name);
-  virtual opt_cs_entry_t update_profiler(profiler_t* p) override;
+  virtual void capture(profiler_t* p, processor_lib_t* proc, hook_args_t& args) override;
+  virtual opt_cs_entry_t update(profiler_t* p, const hook_args_t& args) override;
 
 private:
   pid_t get_prev_pid(profiler_t *p, processor_lib_t* proc);
@@ -0,0 +1,155 @@
+
+#include "pc_event_table.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace profiler {
+
+#define PC_EVENT_INIT_SLOTS_LOG2 6
+
+pc_event_table_t::pc_event_table_t() {
+  this->pages.resize((1ULL << PC_EVENT_PAGE_BITS) / 64, 0);
+  this->slots.resize(1ULL << PC_EVENT_INIT_SLOTS_LOG2, { PC_EVENT_EMPTY, {} });
+  this->mask = slots.size() - 1;
+  this->shift = 64 - PC_EVENT_INIT_SLOTS_LOG2;
+  this->nentries = 0;
+}
+
+pc_event_t& pc_event_table_t::insert(addr_t pc) {
+  if (2 * (nentries + 1) > slots.size())
+    grow();
+
+  size_t i = slot_hash(pc);
+  while (slots[i].pc != pc && slots[i].pc != PC_EVENT_EMPTY)
+    i = (i + 1) & mask;
+  if (slots[i].pc == PC_EVENT_EMPTY) {
+    slots[i].pc = pc;
+    slots[i].ev = { nullptr, 0, false, false };
+    nentries++;
+
+    uint64_t p = pc_event_page_hash(pc);
+    pages[p >> 6] |= 1ULL << (p & 63);
+  }
+  return slots[i].ev;
+}
+
+// Doubles the number of slots and reinserts every entry
+void pc_event_table_t::grow() {
+  std::vector<slot_t> old;
+  old.swap(slots);
+  slots.resize(2 * old.size(), { PC_EVENT_EMPTY, {} });
+  mask = slots.size() - 1;
+  shift--;
+  for (auto& s : old) {
+    if (s.pc == PC_EVENT_EMPTY)
+      continue;
+    size_t i = slot_hash(s.pc);
+    while (slots[i].pc != PC_EVENT_EMPTY)
+      i = (i + 1) & mask;
+    slots[i] = s;
+  }
+}
+
+// Returns the index of the first entry in [i, n) whose page has a hook, or n
+typedef size_t (*pc_page_filter_t)(const uint64_t* pages, const trace_entry_t* entries,
+                                   size_t i, size_t n);
+
+static size_t find_hooked_page_scalar(const uint64_t* pages, const trace_entry_t* entries,
+                                      size_t i, size_t n) {
+  for (; i < n; i++) {
+    uint64_t p = pc_event_page_hash(entries[i].pc);
+    if (pages[p >> 6] & (1ULL << (p & 63)))
+      return i;
+  }
+  return n;
+}
+
+#if defined(__x86_64__)
+
+static_assert(sizeof(trace_entry_t) == 3 * sizeof(uint64_t), "trace_entry_t layout changed");
+
+// pcs of 4 consecutive entries, which span 3 vectors: the pcs sit in qwords
+// 0 and 3 of a, 2 of b and 1 of c
+__attribute__((target("avx2")))
+static inline __m256i load_pcs_avx2(const trace_entry_t* entries) {
+  const __m256i* p = (const __m256i*)entries;
+  __m256i a = _mm256_loadu_si256(p + 0);
+  __m256i b = _mm256_loadu_si256(p + 1);
+  __m256i c = _mm256_loadu_si256(p + 2);
+  // { a0, c1, b2, a3 } -> { a0, a3, b2, c1 }
+  __m256i v = _mm256_blend_epi32(_mm256_blend_epi32(a, b, 0x30), c, 0x0c);
+  return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 2, 3, 0));
+}
+
+// Bit of each pc's page in the bitmap, zero when the page has no hooks
+__attribute__((target("avx2")))
+static inline __m256i page_bits_avx2(const uint64_t* pages, __m256i pc) {
+  const __m256i page_mask = _mm256_set1_epi64x((1LL << PC_EVENT_PAGE_BITS) - 1);
+  const __m256i bit_mask  = _mm256_set1_epi64x(63);
+  const __m256i one       = _mm256_set1_epi64x(1);
+
+  __m256i h = _mm256_and_si256(
+      _mm256_xor_si256(_mm256_srli_epi64(pc, PC_EVENT_PAGE_SHIFT),
+                       _mm256_srli_epi64(pc, PC_EVENT_PAGE_SHIFT + PC_EVENT_PAGE_BITS)),
+      page_mask);
+  __m256i w = _mm256_i64gather_epi64((const long long*)pages, _mm256_srli_epi64(h, 6), 8);
+  return _mm256_and_si256(w, _mm256_sllv_epi64(one, _mm256_and_si256(h, bit_mask)));
+}
+
+// Tests the pages of 8 pcs at a time. Loading the entries and picking out the
+// pcs is faster than gathering them, only the bitmap words are gathered.
+__attribute__((target("avx2")))
+static size_t find_hooked_page_avx2(const uint64_t* pages, const trace_entry_t* entries,
+                                    size_t i, size_t n) {
+  const __m256i zero = _mm256_setzero_si256();
+  for (; i + 8 <= n; i += 8) {
+    __m256i lo = page_bits_avx2(pages, load_pcs_avx2(entries + i));
+    __m256i hi = page_bits_avx2(pages, load_pcs_avx2(entries + i + 4));
+    int clear = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, zero))) |
+               (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, zero))) << 4);
+    if (clear != 0xff)
+      return i + __builtin_ctz(~clear & 0xff);
+  }
+  return find_hooked_page_scalar(pages, entries, i, n);
+}
+
+#endif // __x86_64__
+
+static pc_page_filter_t select_page_filter() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return find_hooked_page_avx2;
+#endif
+  return find_hooked_page_scalar;
+}
+
+static pc_page_filter_t page_filter() {
+  static const pc_page_filter_t filter = select_page_filter();
+  return filter;
+}
+
+const char* pc_event_scan_name() {
+#if defined(__x86_64__)
+  if (page_filter() == find_hooked_page_avx2) return "avx2";
+#endif
+  return "scalar";
+}
+
+size_t pc_event_table_t::scan(const trace_entry_t* entries, size_t n,
+                              std::vector<size_t>& exits) const {
+  pc_page_filter_t filter = page_filter();
+  for (size_t i = 0; (i = filter(pages.data(), entries, i, n)) < n; i++) {
+    const pc_event_t* e = lookup(entries[i].pc);
+    if (e == nullptr)
+      continue;
+    if (e->is_start)
+      return i;
+    if (e->is_exit)
+      exits.push_back(i);
+  }
+  return n;
+}
+
+} // namespace profiler
@@ -0,0 +1,93 @@
+#ifndef __PC_EVENT_TABLE_H__
+#define __PC_EVENT_TABLE_H__
+
+#include <vector>
+#include <inttypes.h>
+#include "types.h"
+#include "../lib/trace.h"
+
+namespace profiler {
+
+// The page bitmap has one bit per hash of the page number. The hash only
+// uses shifts so that it can be computed on several pcs at once (see
+// pc_event_table_t::scan). Folding in the page number from bit 28 up maps
+// 256 MB of code around any base to distinct bits.
+#define PC_EVENT_PAGE_SHIFT 12
+#define PC_EVENT_PAGE_BITS  16
+
+static inline uint64_t pc_event_page_hash(addr_t pc) {
+  return ((pc >> PC_EVENT_PAGE_SHIFT) ^ (pc >> (PC_EVENT_PAGE_SHIFT + PC_EVENT_PAGE_BITS))) &
+         ((1ULL << PC_EVENT_PAGE_BITS) - 1);
+}
+
+class function_t;
+
+// Hooks registered at a pc
+struct pc_event_t {
+  function_t* func;   // function that starts at the pc, nullptr if !is_start
+  uint32_t func_id;   // dense id of func, assigned by profiler_state_t
+  bool is_start;
+  bool is_exit;
+};
+
+// Name of the pc_event_table_t::scan prefilter picked for this cpu
+const char* pc_event_scan_name();
+
+// Maps registered pcs to their pc_event_t with one probe.
+//
+// Almost all pcs looked up are not hooked, so lookups first test a bitmap
+// with one bit per (hashed) page of code that contains a hooked pc. The
+// bitmap is small enough to stay in L1, and only pcs on hooked pages go on
+// to the open addressing table (linear probing, at most half full).
+class pc_event_table_t {
+public:
+  pc_event_table_t();
+
+  // Entry of pc, inserted zeroed if the pc has no hooks yet
+  pc_event_t& insert(addr_t pc);
+
+  // nullptr if nothing is registered at pc
+  const pc_event_t* lookup(addr_t pc) const {
+    uint64_t p = pc_event_page_hash(pc);
+    if (!(pages[p >> 6] & (1ULL << (p & 63))))
+      return nullptr;
+    for (size_t i = slot_hash(pc); ; i = (i + 1) & mask) {
+      const slot_t& s = slots[i];
+      if (s.pc == pc)
+        return &s.ev;
+      if (s.pc == PC_EVENT_EMPTY)
+        return nullptr;
+    }
+  }
+
+  // Index of the first entry at the start of a registered function, or n if
+  // there is none. The indices of the exits before it are appended to exits.
+  // Entries on pages without hooks are skipped with SIMD when available.
+  size_t scan(const trace_entry_t* entries, size_t n, std::vector<size_t>& exits) const;
+
+  size_t size() const { return nentries; }
+
+private:
+  // pcs are at least 2 byte aligned, so no pc is odd
+  static constexpr addr_t PC_EVENT_EMPTY = ~0ULL;
+
+  struct slot_t {
+    addr_t pc;
+    pc_event_t ev;
+  };
+
+  size_t slot_hash(addr_t pc) const {
+    return (size_t)(((pc >> 1) * 0x9E3779B97F4A7C15ULL) >> shift);
+  }
+  void grow();
+
+  std::vector<uint64_t> pages;
+  std::vector<slot_t> slots;
+  size_t mask;
+  int shift;
+  size_t nentries;
+};
+
+} // namespace profiler
+
+#endif // __PC_EVENT_TABLE_H__
@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <vector>
 #include <map>
+#include <thread>
 
 #include <riscv/cfg.h>
 #include <riscv/debug_module.h>
@@ -64,6 +65,14 @@ profiler_t::profiler_t(
   this->stack_unwinder_ = new stack_unwinder_t(dwarf_paths, callstack_outfile);
   this->pstate_ = new profiler_state_t();
   this->logger_ = new logger_t(prof_outdir);
+  this->commits_ = new spsc_ring_t<commit_record_t>(PROF_COMMIT_RING_ENTRIES);
+  this->hook_args_ = new spsc_ring_t<hook_args_t>(PROF_COMMIT_RING_ENTRIES);
+  this->flight_path = prof_outdir + "/FLIGHT-RECORDER.bin";
+
+  // The callstacks and the rest of profiler_state_t are not kept per hart
+  if (nprocs() != 1) {
+    pexit("The profiler supports a single hart, got %zu\n", nprocs());
+  }
 
   this->logger_->submit_packet(new perfetto::trackdescriptor_packet_t(
         "FOOB_PROF",
@@ -110,6 +119,8 @@ profiler_t::~profiler_t() {
   delete this->stack_unwinder_;
   delete this->pstate_;
   delete this->logger_;
+  delete this->commits_;
+  delete this->hook_args_;
 }
 
 void profiler_t::profile_kernel_func_at_exit(
@@ -139,7 +150,7 @@ objdump_parser_t* profiler_t::get_objdump_parser(std::string oname) {
 }
 
 reg_t profiler_t::get_pc(int hartid) {
-  processor_t* proc = get_core(hartid);
+  processor_t* proc = get_hart_core(hartid);
   state_t* state = proc->get_state();
   return state->pc;
 }
@@ -193,6 +204,9 @@ int profiler_t::run() {
 
   uint64_t single_step_cnt = 0;
 
+  // Indices of the exits found in the current chunk
+  std::vector<size_t> exits;
+
   auto run_s = GET_TIME();
   while (target_running()) {
     std::string protobuf;
@@ -214,19 +228,16 @@ int profiler_t::run() {
     int popcnt = 0;
 
     auto trace_check_s = GET_TIME();
-    for (size_t i = 0, cnt = pctrace.size(); i < cnt; i++) {
-      reg_t pc = pctrace[i].pc;
-      if (pstate_->found_registered_func_start_addr(pc).has_value()) {
+    exits.clear();
+    size_t first_start = pstate_->scan_pc_events(pctrace.data(), pctrace.size(), exits);
+    if (first_start < pctrace.size()) {
 #ifdef PROFILER_DEBUG
-        pprintf("Rewind PC: 0x%" PRIx64 "\n", pc);
+      pprintf("Rewind PC: 0x%" PRIx64 "\n", pctrace[first_start].pc);
 #endif
-        rewind = true;
-        fwd_steps = i;
-        break;
-      } else if (pstate_->found_registered_func_exit_addr(pc).has_value()) {
-        popcnt++;
-      }
+      rewind = true;
+      fwd_steps = first_start;
     }
+    popcnt = (int)exits.size();
     auto trace_check_e = GET_TIME();
     MEASURE_AVG_TIME(trace_check_s, trace_check_e, trace_check_us, trace_check_cnt);
 
@@ -251,11 +262,11 @@ int profiler_t::run() {
 
       bool found_function = false;
       do {
-        addr_t va = this->get_pc(0);
-        optreg_t opt_sa = pstate_->found_registered_func_start_addr(va);
+        addr_t va = this->get_pc(get_core(0)->get_id());
+        const pc_event_t* e = pstate_->lookup_pc_event(va);
 
-        if (unlikely(opt_sa.has_value())) {
-          auto f = pstate_->get_profile_func(opt_sa.value());
+        if (unlikely(e != nullptr && e->is_start)) {
+          auto f = e->func;
 
           // TODO : This logic of returning a stack entry for certain
           // functions is not that pretty.
@@ -302,63 +313,145 @@ int profiler_t::run() {
 int profiler_t::run_from_trace() {
   init();
 
-  // TODO : multicore support
-  int hartid = 0;
   this->configure_log(true, true);
-  this->get_core(hartid)->get_state()->pc = ROCKETCHIP_RESET_VECTOR;
+  set_trace_policy(TRACE_POLICY_NONE);
+  for (size_t i = 0; i < nprocs(); i++)
+    get_core(i)->get_state()->pc = ROCKETCHIP_RESET_VECTOR;
+
+  // All hooks are registered by now
+  trace_reader->set_classifier(pstate_);
+  trace_reader->start();
+
+  // This thread only steps spike and reads what the hooks need from it
+  std::thread analysis([this] { analyze_commits(); });
 
-  uint64_t bufid = 0;
   uint64_t cnt = 0;
+  uint64_t hook_cnt = 0;
+  uint64_t last_time = 0;
+  double run_us = 0.0;
+  auto run_s = GET_TIME();
+  trace_run_t run;
   while (target_running()) {
-    trace_buffer_t* buf = trace_reader->cur_buffer();
-/* printf("start processing buf: %" PRIu64 "\n", bufid); */
-    while (!buf->can_consume()) {
-      ;
+    if (!trace_reader->next(run)) {
+      pprintf("Reached the end of the RTL trace\n");
+      break;
     }
-    while (!buf->empty()) {
-      rtl_step_t& step = buf->pop_front();
-      if (!(step.val || step.except || step.intrpt)) {
-        continue;
+    int hartid = run.hartid;
+    // Bubbles are already dropped by the trace reader
+    for (rtl_step_t* step = run.begin(); step != run.end(); ) {
+      uint64_t tohost_req = take_tohost_req();
+      if (unlikely(tohost_req))
+        handle_tohost_req(tohost_req);
+
+      // Only steps after which the hart may be at a hook end a batch
+      size_t n = run.end() - step;
+      size_t batch = 0;
+      while (batch < n && step[batch++].event == TRACE_EVENT_NONE)
+        ;
+
+      size_t done = ganged_run(step, batch, hartid);
+      if (done == 0) {
+        dump_flight_recorder();
+        passert("ganged simulation failed!\n");
       }
+      step += done;
+      cnt += done;
+      last_time = step[-1].time;
+
+      // The trace reader already classified the pc the hart continues at,
+      // except at the end of a work unit or before a trap
+      rtl_step_t& last = step[-1];
+      uint8_t event = last.event;
+      if (likely(event == TRACE_EVENT_NONE))
+        continue;
 
-      if ((cnt++ & TOHOST_CHECK_PERIOD) == 0) {
-        uint64_t tohost_req = check_tohost_req();
-        if (tohost_req)
-          handle_tohost_req(tohost_req);
+      function_t* f = nullptr;
+      uint32_t func_id = 0;
+      bool is_exit = false;
+      if (likely(event != TRACE_EVENT_UNKNOWN)) {
+        if (unlikely(event >= TRACE_EVENT_FUNC)) {
+          func_id = event - TRACE_EVENT_FUNC;
+          f = pstate_->get_func(func_id);
+        }
+        is_exit = (event == TRACE_EVENT_EXIT);
+      } else if (const pc_event_t* e = pstate_->lookup_pc_event(this->get_pc(hartid))) {
+        f = e->func;
+        func_id = e->func_id;
+        is_exit = e->is_exit;
       }
+      if (likely(f == nullptr && !is_exit))
+        continue;
 
-      processor_lib_t* proc = get_core(hartid);
-      bool success = ganged_step(step, hartid);
-      if (!success) {
-        passert("ganged simulation failed!\n");
+      commit_record_t rec;
+      rec.time = last.time;
+      rec.pc = this->get_pc(hartid);
+      rec.asid = get_asid(hartid);
+      rec.func_id = func_id;
+      rec.kind = (f != nullptr) ? COMMIT_START : COMMIT_EXIT;
+      if (f != nullptr) {
+        hook_args_t args = {};
+        f->capture(this, get_hart_core(hartid), args);
+        hook_args_->push(std::move(args));
       }
-      pstate_->update_timestamp(step.time);
-
-      addr_t pc = this->get_pc(hartid);
-      optreg_t opt_sa = pstate_->found_registered_func_start_addr(pc);
-      if (opt_sa.has_value()) {
-        auto f = pstate_->get_profile_func(opt_sa.value());
-        opt_cs_entry_t entry = f->update_profiler(this);
-        if (entry.has_value()) {
-          pstate_->push_callstack(pstate_->get_curpid(), entry.value());
-        }
-      } else if (pstate_->found_registered_func_exit_addr(pc).has_value()) {
-        pstate_->pop_callstack(pstate_->get_curpid());
-      }
-      logger_->submit_packet_trace_to_threadpool();
+      commits_->push(rec);
+      hook_cnt++;
     }
-    buf->done_consume();
-    trace_reader->pop_buffer();
-    bufid++;
   }
+  commit_record_t end = { last_time, 0, 0, 0, COMMIT_END };
+  commits_->push(end);
+  analysis.join();
+
+  auto run_e = GET_TIME();
+  MEASURE_TIME(run_s, run_e, run_us);
 
   logger_->flush_packet_trace_to_threadpool();
   logger_->stop();
   pstate_->dump_asid2bin_mapping(prof_outdir_);
   auto rc = stop_sim();
+
+  double consumer_stall_us = trace_reader->consumer_stall_ns() / 1000.0;
+  double producer_stall_us = trace_reader->producer_stall_ns() / 1000.0;
+  PRINT_TIME_STAT("RUN TOOK", run_us);
+  PRINT_CNTR_STAT("REPLAYED_STEPS", cnt);
+  PRINT_RATE_STAT("REPLAY_STEPS", (double)cnt, run_us);
+  PRINT_CNTR_STAT("HOOK_COMMITS", hook_cnt);
+  PRINT_TIME_STAT("COMMIT_PRODUCER_STALL", commits_->producer_stall_ns() / 1000.0);
+  PRINT_TIME_STAT("COMMIT_CONSUMER_STALL", commits_->consumer_stall_ns() / 1000.0);
+  PRINT_TIME_STAT("TRACE_CONSUMER_STALL", consumer_stall_us);
+  PRINT_TIME_STAT("TRACE_PRODUCER_STALL", producer_stall_us);
+  PRINT_CNTR_STAT("TRACE_READER_DEPTH", (uint64_t)trace_reader->depth());
+  PRINT_CNTR_STAT("TRACE_READER_MAX_DEPTH", (uint64_t)trace_reader->max_depth());
+  PRINT_CNTR_STAT("TRACE_READER_THREADS", (uint64_t)trace_reader->active_threads());
+  PRINT_CNTR_STAT("TRACE_READER_MAX_THREADS", (uint64_t)trace_reader->max_active_threads());
+  PRINT_CNTR_STAT("TRACE_BUBBLES", trace_reader->bubbles());
   return rc;
 }
 
+// The timestamp of profiler_state_t is only read by the hooks, which all run
+// here, so it follows the RTL time of the commits rather than every replayed
+// batch. The replay thread only does lookups in pstate_, its mutable state
+// belongs to this thread. COMMIT_END moves it to the last replayed step.
+void profiler_t::analyze_commits() {
+  while (true) {
+    commit_record_t rec = commits_->pop();
+    pstate_->update_timestamp(rec.time);
+    if (rec.kind == COMMIT_END)
+      break;
+
+    if (rec.kind == COMMIT_START) {
+      hook_args_t args = hook_args_->pop();
+      function_t* f = pstate_->get_func(rec.func_id);
+      opt_cs_entry_t entry = f->update(this, args);
+      if (entry.has_value()) {
+        pstate_->push_callstack(pstate_->get_curpid(), entry.value());
+      }
+    } else {
+      pstate_->pop_callstack(pstate_->get_curpid());
+    }
+    logger_->submit_packet_trace_to_threadpool();
+  }
+}
+
 void profiler_t::process_callstack() {
   pprintf("Start stack unwinding\n");
   uint64_t trace_cnt = logger_->get_trace_idx();
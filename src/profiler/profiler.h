@@ -24,6 +24,7 @@
 #include "perfetto_trace.h"
 #include "profiler_state.h"
 #include "logger.h"
+#include "../lib/spsc_ring.h"
 
 /* #define PROFILER_DEBUG */
 
@@ -49,10 +50,29 @@
 #define PRINT_AVG_TIME_STAT(N, T, C) \
   pprintf("Avg (us) %s: %f / %" PRIu64 "  = %f\n", N, T, C, T/C)
 
+#define PRINT_RATE_STAT(N, X, T) \
+  pprintf("Rate (/s) %s: %f\n", N, X / (T / (1000 * 1000)))
+
 
 
 namespace profiler {
 
+enum commit_kind_t {
+  COMMIT_START,   // a registered function starts, its hook_args_t follow
+  COMMIT_EXIT,    // a registered exit
+  COMMIT_END      // the replay is over
+};
+
+// Published by the replay thread of run_from_trace for every retired
+// instruction that hits a hook
+struct commit_record_t {
+  uint64_t time;
+  uint64_t pc;
+  uint64_t asid;
+  uint32_t func_id;   // pc_event_t::func_id for COMMIT_START
+  uint32_t kind;      // commit_kind_t
+};
+
 class profiler_t : public sim_lib_t {
 public:
   profiler_t(std::vector<std::pair<std::string, std::string>> objdump_paths,
@@ -93,10 +113,20 @@ private:
   bool user_space_addr(addr_t va);
   FILE* gen_outfile(std::string outdir, std::string filename);
 
+  // Analysis thread of run_from_trace: runs the hooks, keeps the callstacks
+  // and submits the perfetto packets, in commit order
+  void analyze_commits();
+
   logger_t* logger_;
   profiler_state_t* pstate_;
   stack_unwinder_t* stack_unwinder_;
 
+  // Replay thread -> analysis thread, hook_args_ has one entry per
+  // COMMIT_START in commits_
+  const size_t PROF_COMMIT_RING_ENTRIES = 1 << 14;
+  spsc_ring_t<commit_record_t>* commits_;
+  spsc_ring_t<hook_args_t>* hook_args_;
+
   std::string prof_outdir_;
   std::map<std::string, objdump_parser_t*> objdumps_;
 };
@@ -86,7 +86,18 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --kernel-info=<name>  <objdump,dwarf> of kernel\n");
   fprintf(stderr, "  --user-info=<name>    <objdump,dwarf>+<objdump,dwarf>... of space programs\n");
   fprintf(stderr, "  --prof-out=<name>     Directory to output profiling data\n");
-  fprintf(stderr, "  --rtl-cfg=<dir:nthreads:traces_per_file:max_file_bytes> (Trace directory):(nthreads to decompress):(max insns per file):(max uncompressed file bytes)\n");
+  fprintf(stderr, "  --lockstep-min=<n>    Shortest run of plain RTL retirements replayed in one batch, 0 to\n");
+  fprintf(stderr, "                        replay every retirement with step(1) [default %zu]\n",
+          sim_lib_t::LOCKSTEP_MIN_STEPS);
+  fprintf(stderr, "  --rtl-cfg=<dir:nthreads:traces_per_file[:chunk_bytes[:budget_mb]]>\n");
+  fprintf(stderr, "                        Replay the RTL commit trace, empty fields keep their defaults\n");
+  fprintf(stderr, "                          dir              COSPIKE-TRACE directory\n");
+  fprintf(stderr, "                          nthreads         Decompression threads [default 0, all cores]\n");
+  fprintf(stderr, "                          traces_per_file  Instructions per trace file\n");
+  fprintf(stderr, "                          chunk_bytes      Decompression chunk size, up to %d [default %d]\n",
+          TRACE_MAX_CHUNK_BYTES, TRACE_DEFAULT_CHUNK_BYTES);
+  fprintf(stderr, "                          budget_mb        Trace reader memory budget in MB [default %llu]\n",
+          TRACE_READER_MEM_BUDGET >> 20);
 
   exit(exit_code);
 }
@@ -499,6 +510,10 @@ int main(int argc, char** argv)
       dwarf_paths.push_back({dirs.back(), info[0]});
     }
   });
+  size_t lockstep_min_steps = sim_lib_t::LOCKSTEP_MIN_STEPS;
+  parser.option(0, "lockstep-min", 1, [&](const char* s){
+      lockstep_min_steps = strtoull(s, 0, 0);
+  });
   const char* rtl_cfg_char = NULL;
   parser.option(0, "rtl-cfg", 1, [&](const char* s){
       rtl_cfg_char = s;
@@ -583,6 +598,7 @@ int main(int argc, char** argv)
   }
   p.configure_log(log, log_commits);
   p.set_debug(debug);
+  p.lockstep_min_steps = lockstep_min_steps;
 
   int return_code;
   if (!rtl_lockstep) {
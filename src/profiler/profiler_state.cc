@@ -15,12 +15,20 @@ profiler_state_t::~profiler_state_t() {
 }
 
 void profiler_state_t::add_prof_func(addr_t va, function_t* f) {
-  prof_pc_to_func_[va] = f;
-  func_pc_prof_start_.push_back(va);
+  uint32_t id = 0;
+  while (id < event_funcs_.size() && event_funcs_[id] != f)
+    id++;
+  if (id == event_funcs_.size())
+    event_funcs_.push_back(f);
+
+  pc_event_t& e = pc_events_.insert(va);
+  e.is_start = true;
+  e.func = f;
+  e.func_id = id;
 }
 
 void profiler_state_t::add_prof_exit(addr_t va) {
-  func_pc_prof_exit_.push_back(va);
+  pc_events_.insert(va).is_exit = true;
 }
 
 reg2str_t& profiler_state_t::asid2bin() {
@@ -80,22 +88,21 @@ void profiler_state_t::push_callstack(reg_t pid, callstack_entry_t entry) {
   pid_to_callstack_[pid].push_back(entry);
 }
 
-optreg_t profiler_state_t::found_registered_func_start_addr(reg_t va) {
-  for (auto &x : func_pc_prof_start_) {
-    if (unlikely(x == va)) return optreg_t(va);
-  }
-  return {};
-}
-
-optreg_t profiler_state_t::found_registered_func_exit_addr(reg_t va) {
-  for (auto &x : func_pc_prof_exit_) {
-    if (unlikely(x == va)) return optreg_t(va);
+// Functions that do not fit into an event tag are looked up by the consumer
+uint8_t profiler_state_t::classify(uint64_t va) const {
+  const pc_event_t* e = pc_events_.lookup(va);
+  if (likely(e == nullptr))
+    return TRACE_EVENT_NONE;
+  if (e->is_start) {
+    if (e->func_id < TRACE_MAX_EVENT_FUNCS)
+      return (uint8_t)(TRACE_EVENT_FUNC + e->func_id);
+    return TRACE_EVENT_UNKNOWN;
   }
-  return {};
+  return TRACE_EVENT_EXIT;
 }
 
-function_t* profiler_state_t::get_profile_func(reg_t va) {
-  return prof_pc_to_func_[va];
+function_t* profiler_state_t::get_event_func(uint8_t event) {
+  return get_func(event - TRACE_EVENT_FUNC);
 }
 
 void profiler_state_t::dump_asid2bin_mapping(std::string outdir) {
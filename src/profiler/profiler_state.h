@@ -5,13 +5,15 @@
 #include <string>
 #include "callstack_info.h"
 #include "types.h"
+#include "pc_event_table.h"
+#include "../lib/trace_reader.h"
 
 namespace profiler {
 
 class function_t;
 class callstack_entry_t;
 
-class profiler_state_t {
+class profiler_state_t : public trace_classifier_t {
 public:
   profiler_state_t();
   ~profiler_state_t();
@@ -37,17 +39,29 @@ public:
   void pop_callstack (reg_t pid);
   void push_callstack(reg_t pid, callstack_entry_t entry);
 
-  optreg_t found_registered_func_start_addr(reg_t va);
-  optreg_t found_registered_func_exit_addr(reg_t va);
+  // Hooks registered at va, nullptr if there are none
+  const pc_event_t* lookup_pc_event(reg_t va) const { return pc_events_.lookup(va); }
 
-  function_t* get_profile_func(reg_t va);
+  // Index of the first entry at a registered function start (n if none),
+  // appending the indices of the exits before it to exits
+  size_t scan_pc_events(const trace_entry_t* entries, size_t n, std::vector<size_t>& exits) const {
+    return pc_events_.scan(entries, n, exits);
+  }
+
+  // Same lookup folded into a TRACE_EVENT_* tag. Also called by the trace
+  // reader threads, so functions must not be registered anymore once the
+  // trace reader has started.
+  uint8_t classify(uint64_t va) const override;
+  function_t* get_event_func(uint8_t event);
+  function_t* get_func(uint32_t func_id) { return event_funcs_[func_id]; }
 
   void dump_asid2bin_mapping(std::string outdir);
 
 private:
-  std::map<addr_t, function_t*> prof_pc_to_func_;
-  std::vector<addr_t> func_pc_prof_start_;
-  std::vector<addr_t> func_pc_prof_exit_;
+  pc_event_table_t pc_events_;
+
+  // Registered functions, indexed by pc_event_t::func_id
+  std::vector<function_t*> event_funcs_;
 
   std::map<reg_t, std::vector<callstack_entry_t>> pid_to_callstack_;
   reg2str_t asid_to_bin_;
@@ -41,8 +41,15 @@ void plic_ganged_t::submit_external_interrupt(uint32_t interrupt_id) {
 
 bool plic_ganged_t::alert_core_external_interrupt(int hartid) {
   if (interrupt_vector == 0) return false;
-  contexts[hartid].proc->get_state()->mip->backdoor_write_with_mask(MIP_SEIP, MIP_SEIP);
-  return true;
+  // A hart has one context per privilege mode, contexts is not indexed by
+  // hartid
+  for (auto& c : contexts) {
+    if ((int)c.proc->get_id() == hartid) {
+      c.proc->get_state()->mip->backdoor_write_with_mask(MIP_SEIP, MIP_SEIP);
+      return true;
+    }
+  }
+  return false;
 }
 
 bool plic_ganged_t::lower_external_interrupt(uint32_t interrupt_id) {
@@ -11,8 +11,10 @@
 
 class ganged_device_t : public abstract_device_t {
 public:
-  ganged_device_t(std::shared_ptr<abstract_device_t> base)
-    : base(base), was_read(false) {}
+  // tick_period: steps between ticks during the replay of an RTL trace, 0
+  // for devices that are not ticked (the clint follows the RTL time)
+  ganged_device_t(std::shared_ptr<abstract_device_t> base, uint64_t tick_period = 0)
+    : was_read(false), tick_period(tick_period), base(base) {}
 
 public:
   virtual bool load(reg_t addr, size_t len, uint8_t* bytes) override {
@@ -37,6 +39,7 @@ public:
 
 public:
   bool was_read;
+  uint64_t tick_period;
 
 private:
   std::shared_ptr<abstract_device_t> base;
@@ -8,6 +8,8 @@
 mmu_lib_t::mmu_lib_t(simif_t* sim, endianness_t endianness, processor_lib_t* proc)
   : mmu_t(sim, endianness, proc) {
   simlib = dynamic_cast<sim_lib_t*>(sim);
+  plib = proc;
+  host_port = (proc == NULL);
 }
 
 mmu_lib_t::~mmu_lib_t() {
@@ -61,12 +63,26 @@ void mmu_lib_t::store_slow_path_intrapage(reg_t len,
       }
 #endif
       memcpy(host_addr, bytes, len);
-      if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
+
+      // Stores of the target to the tohost/fromhost pages never refill the
+      // TLB so that every store to either word comes through here. The host
+      // writes them through the debug mmu, which is not watched.
+      if (unlikely(!host_port && simlib->htif_watched(paddr, len))) {
+        simlib->htif_store(paddr, len);
+        plib->host_store = true;
+      }
+
+      if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE)) {
         tracer.trace(paddr, len, STORE);
-      else if (!access_info.flags.is_special_access())
+      } else if (!access_info.flags.is_special_access() &&
+                 (host_port || !simlib->htif_page(paddr))) {
         refill_tlb(addr, paddr, host_addr, STORE);
-    } else if (!mmio_store(paddr, len, bytes)) {
-      throw trap_store_access_fault(access_info.effective_virt, addr, 0, 0);
+      }
+    } else {
+      if (!host_port)
+        plib->host_store = true;
+      if (!mmio_store(paddr, len, bytes))
+        throw trap_store_access_fault(access_info.effective_virt, addr, 0, 0);
     }
   }
 }
@@ -20,6 +20,10 @@ public:
       bool actually_store) override;
 
   sim_lib_t* simlib;
+  processor_lib_t* plib;
+
+  // The debug mmu, through which the host accesses target memory
+  bool host_port;
 };
 
 #endif //__MMU_LIB_H__
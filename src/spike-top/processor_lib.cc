@@ -72,7 +72,23 @@ reg_t processor_lib_t::get_mcycle() {
 }
 
 void processor_lib_t::step(size_t n) {
+  switch (trace_policy) {
+    case TRACE_POLICY_NONE: step_traced<TRACE_POLICY_NONE>(n); break;
+    case TRACE_POLICY_BB:   step_traced<TRACE_POLICY_BB>(n);   break;
+    default:                step_traced<TRACE_POLICY_FULL>(n); break;
+  }
+}
+
+template <trace_policy_t P>
+void processor_lib_t::step_traced(size_t n) {
+  // Callers step at most INTERLEAVE instructions, the buffer is reused
   trace.clear();
+  bb_trace.clear();
+  if (P == TRACE_POLICY_FULL)
+    trace.reserve(n);
+  size_t fetched = 0;
+  // pc that continues the last run of bb_trace
+  reg_t bb_next = ~(reg_t)0;
 
   if (!state.debug_mode) {
     if (halt_request == HR_REGULAR) {
@@ -92,6 +108,17 @@ void processor_lib_t::step(size_t n) {
     state.prv_changed = false;
     state.v_changed = false;
 
+    // satp (and which satp is in use) only changes through serializing
+    // instructions (csr writes, xret) or a trap, and mcycle only through
+    // those or the bump at the end of the round. Both are read at the start
+    // of a round, which every serialization ends, instead of per instruction.
+    reg_t trace_asid = 0;
+    reg_t trace_cycle = 0;
+    if (P != TRACE_POLICY_NONE) {
+      trace_asid = get_asid();
+      trace_cycle = get_mcycle();
+    }
+
     #define advance_pc() \
       if (unlikely(invalid_pc(pc))) { \
         switch (pc) { \
@@ -106,6 +133,15 @@ void processor_lib_t::step(size_t n) {
         instret++; \
       }
 
+    #define trace_insn(fetch) \
+      fetched++; \
+      if (P == TRACE_POLICY_FULL) { \
+        trace.push_back({pc, trace_asid, trace_cycle + instret}); \
+      } else if (P == TRACE_POLICY_BB) { \
+        bb_trace_add(bb_trace, pc, trace_asid, trace_cycle + instret, bb_next, id); \
+        bb_next = pc + (fetch).insn.length(); \
+      }
+
     try
     {
       take_pending_interrupt();
@@ -145,7 +181,7 @@ void processor_lib_t::step(size_t n) {
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
-          trace.push_back({pc, get_asid(), get_mcycle() + instret});
+          trace_insn(fetch);
           pc = execute_insn_logged(this, pc, fetch);
           advance_pc();
         }
@@ -155,7 +191,7 @@ void processor_lib_t::step(size_t n) {
         // Main simulation loop, fast path.
         for (auto ic_entry = _mmu->access_icache(pc); ; ) {
           auto fetch = ic_entry->data;
-          trace.push_back({pc, get_asid(), get_mcycle() + instret});
+          trace_insn(fetch);
           pc = execute_insn_fast(this, pc, fetch);
           ic_entry = ic_entry->next;
           if (unlikely(ic_entry->tag != pc))
@@ -214,6 +250,132 @@ void processor_lib_t::step(size_t n) {
 
     n -= instret;
   }
+  stepped = fetched;
+}
+
+// Overwrites the destination register with the RTL writeback and returns
+// true if the step stored to an address the caller has to handle
+bool processor_lib_t::lockstep_commit(const rtl_step_t& step) {
+  for (auto& regwrite : state.log_reg_write) {
+    int rd = regwrite.first >> 4;
+    int type = regwrite.first & 0xf;
+    if (rd != 0 && type == 0)
+      state.XPR.write(rd, step.wdata);
+  }
+  return host_store;
+}
+
+// Same loop as the slow path of step(), with the checks of ganged_step per
+// instruction. The fast path of step() (execute_insn_fast through the
+// icache) can not be used: it does not fill log_reg_write, and the
+// instruction bits alone do not say whether rd is an integer destination
+// that has to take the RTL writeback.
+size_t processor_lib_t::step_lockstep(const rtl_step_t* steps, size_t n) {
+  trace.clear();
+  host_store = false;
+  if (unlikely(debug || state.debug_mode || halt_request != HR_NONE ||
+               state.dcsr->halt || state.single_step != state.STEP_NONE ||
+               check_triggers_icount || !get_log_commits_enabled()))
+    return 0;
+
+  bool traced = (trace_policy == TRACE_POLICY_FULL);
+  if (traced)
+    trace.reserve(n);
+  size_t done = 0;
+  bool stop = false;
+  while (done < n && !stop) {
+    size_t instret = 0;
+    reg_t pc = state.pc;
+    state.prv_changed = false;
+    state.v_changed = false;
+    // A round ends at every serialization and trap, see step()
+    reg_t trace_asid = traced ? get_asid() : 0;
+    reg_t trace_cycle = traced ? get_mcycle() : 0;
+
+    try
+    {
+      while (done + instret < n) {
+        const rtl_step_t& step = steps[done + instret];
+        if (unlikely(pc != step.pc)) {
+          stop = true;
+          break;
+        }
+
+        in_wfi = false;
+        take_pending_interrupt();
+
+        insn_fetch_t fetch = mmu->load_insn(pc);
+        if (traced)
+          trace.push_back({pc, trace_asid, trace_cycle + instret});
+        pc = execute_insn_logged(this, pc, fetch);
+        if (unlikely(invalid_pc(pc))) {
+          // Serializing instructions end the round so that the counters are
+          // bumped, the instruction is executed again with state.serialized
+          // set in the next one
+          bool retired = (pc == PC_SERIALIZE_AFTER);
+          if (pc == PC_SERIALIZE_BEFORE)
+            state.serialized = true;
+          else if (!retired)
+            abort();
+          pc = state.pc;
+          if (retired) {
+            instret++;
+            stop = lockstep_commit(step);
+          }
+          break;
+        }
+        state.pc = pc;
+        instret++;
+        if (unlikely(lockstep_commit(step))) {
+          stop = true;
+          break;
+        }
+      }
+    }
+    catch(trap_t& t)
+    {
+      // The step is consumed as in ganged_step, the pc of the next step
+      // will not match
+      take_trap(t, pc);
+      lockstep_commit(steps[done + instret]);
+      done++;
+      stop = true;
+
+      auto match = TM.detect_trap_match(t);
+      if (match.has_value())
+        take_trigger_action(match->action, 0, state.pc, 0);
+    }
+    catch (triggers::matched_t& t)
+    {
+      if (mmu->matched_trigger) {
+        delete mmu->matched_trigger;
+        mmu->matched_trigger = NULL;
+      }
+      take_trigger_action(t.action, t.address, pc, t.gva);
+      stop = true;
+    }
+    catch(trap_debug_mode&)
+    {
+      enter_debug_mode(DCSR_CAUSE_SWBP);
+      stop = true;
+    }
+    catch (wait_for_interrupt_t &t)
+    {
+      // wfi retires, ganged_step clears in_wfi before the next step anyway
+      lockstep_commit(steps[done + instret]);
+      instret++;
+      in_wfi = true;
+      stop = true;
+    }
+
+    state.minstret->bump(instret);
+
+    // Model a hart whose CPI is 1.
+    state.mcycle->bump(instret);
+
+    done += instret;
+  }
+  return done;
 }
 
 void processor_lib_t::step_from_trace(int rd, uint64_t wdata, reg_t npc) {
@@ -6,6 +6,7 @@
 #include <google/protobuf/arena.h>
 #include "arch-state.pb.h"
 #include "../lib/trace.h"
+#include "../lib/trace_bb.h"
 
 #define PC_SERIALIZE_BEFORE 3
 #define PC_SERIALIZE_AFTER 5
@@ -13,6 +14,14 @@
 
 class wait_for_interrupt_t {};
 
+// What processor_lib_t::step records. The step loop is compiled once per
+// policy, so that untraced runs do no tracing work.
+enum trace_policy_t {
+  TRACE_POLICY_NONE,  // nothing
+  TRACE_POLICY_BB,    // runs of sequential instructions in step_bb_trace()
+  TRACE_POLICY_FULL   // every instruction in step_trace()
+};
+
 class processor_lib_t : public processor_t
 {
 public:
@@ -24,11 +33,39 @@ public:
   reg_t get_asid();
   reg_t get_mcycle();
   trace_t& step_trace() { return trace; }
+  bb_trace_t& step_bb_trace() { return bb_trace; }
+  void set_trace_policy(trace_policy_t policy) { trace_policy = policy; }
+  trace_policy_t get_trace_policy() { return trace_policy; }
+  // Instructions fetched by the last step(), the trace size under
+  // TRACE_POLICY_FULL
+  size_t step_insns() { return stepped; }
   virtual void step(size_t n) override;
   void step_from_trace(int rd, uint64_t wdata, reg_t npc);
 
+  // Replays up to n plain retirements (val && !except && !intrpt) of the RTL
+  // trace in one call, doing per step what sim_lib_t::ganged_step does
+  // around step(1): the pc is checked, wfi is cleared and the destination
+  // register is overwritten with the RTL value. Stops before a step whose pc
+  // does not match and after a step that trapped or did a host store, so
+  // that the caller can look at its commit log. Returns the number of steps
+  // replayed, 0 when batching is not possible (debug, triggers, commit
+  // logging off).
+  size_t step_lockstep(const rtl_step_t* steps, size_t n);
+
+  // Set by mmu_lib_t when a store goes to MMIO or to tohost/fromhost, which
+  // are told apart by physical address
+  bool host_store = false;
+
 private:
   trace_t trace;
+  bb_trace_t bb_trace;
+  trace_policy_t trace_policy = TRACE_POLICY_FULL;
+  size_t stepped = 0;
+
+  template <trace_policy_t P>
+  void step_traced(size_t n);
+
+  bool lockstep_commit(const rtl_step_t& step);
 
 public:
   google::protobuf::Arena* arena;
@@ -9,13 +9,17 @@
 #include <riscv/platform.h>
 #include <fdt/libfdt.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <cstdlib>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <inttypes.h>
 #include <string>
 #include <unistd.h>
@@ -31,6 +35,23 @@ extern device_factory_t* clint_factory;
 extern device_factory_t* plic_factory;
 extern device_factory_t* ns16550_lib_factory;
 
+// Numeric field i of --rtl-cfg, dflt when it is missing or empty
+static uint64_t rtl_cfg_field(const std::vector<std::string>& words, size_t i,
+                              const char* name, uint64_t dflt)
+{
+  if (i >= words.size() || words[i].empty())
+    return dflt;
+
+  char* end = NULL;
+  errno = 0;
+  uint64_t val = strtoull(words[i].c_str(), &end, 10);
+  if (errno != 0 || *end != '\0' || words[i][0] == '-') {
+    std::cerr << "--rtl-cfg: invalid " << name << " '" << words[i] << "'\n";
+    exit(1);
+  }
+  return val;
+}
+
 sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
         std::vector<std::pair<reg_t, abstract_mem_t*>> mems,
         std::vector<device_factory_t*> plugin_device_factories,
@@ -88,6 +109,9 @@ sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
     procs[i] = new processor_lib_t(&isa, cfg, this, cfg->hartids[i], halted,
                                log_file.get(), sout_);
     harts[cfg->hartids[i]] = procs[i];
+    if (cfg->hartids[i] >= hart_proc.size())
+      hart_proc.resize(cfg->hartids[i] + 1, -1);
+    hart_proc[cfg->hartids[i]] = (int)i;
   }
 
   // When running without using a dtb, skip the fdt-based configuration steps
@@ -95,7 +119,6 @@ sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
 
   bool from_rtl_trace = (rtl_cfg != NULL);
   if (from_rtl_trace) {
-    // TODO : multicore support?
     std::string rtl_cfg_str(rtl_cfg);
     std::vector<std::string> words;
     split(words, rtl_cfg_str, ':');
@@ -104,12 +127,40 @@ sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
     std::string rtl_trace_dir_str(rtl_trace_dir);
     printf("rtl_trace_dir_str: %s\n", rtl_trace_dir_str.c_str());
 
-    this->trace_reader = new trace_reader_t(0,
-        atoi(words[1].c_str()),
-        (size_t)atoi(words[2].c_str()),
-        (size_t)atoi(words[3].c_str()),
-        rtl_trace_dir_str);
-    this->trace_reader->start();
+    // Empty fields keep their defaults
+    int nthreads = (int)rtl_cfg_field(words, 1, "nthreads", 0);
+    size_t traces_per_file = rtl_cfg_field(words, 2, "traces_per_file", 0);
+    size_t chunk_bytes = rtl_cfg_field(words, 3, "chunk_bytes", TRACE_DEFAULT_CHUNK_BYTES);
+    uint64_t budget_mb = rtl_cfg_field(words, 4, "budget_mb", TRACE_READER_MEM_BUDGET >> 20);
+    if (budget_mb > (UINT64_MAX >> 20)) {
+      std::cerr << "--rtl-cfg: budget_mb " << budget_mb << " overflows a byte count\n";
+      exit(1);
+    }
+    size_t mem_budget = budget_mb << 20;
+
+    // This field used to be the size of the buffer a whole uncompressed
+    // trace file was read into, which is usually far above any sane chunk
+    if (chunk_bytes > TRACE_MAX_CHUNK_BYTES) {
+      std::cerr << "--rtl-cfg: chunk_bytes " << chunk_bytes << " is above "
+                << TRACE_MAX_CHUNK_BYTES << ". The 4th field is the decompression "
+                << "chunk size, not the uncompressed trace file size anymore, "
+                << "leave it empty for the default\n";
+      exit(1);
+    }
+    if (traces_per_file == 0) {
+      std::cerr << "--rtl-cfg: traces_per_file is required\n";
+      exit(1);
+    }
+
+    // The runs of the reader carry RISC-V hartids, see hart_proc
+    std::vector<int> hartids(cfg->hartids.begin(), cfg->hartids.end());
+    this->trace_reader = new merged_trace_reader_t(hartids,
+        nthreads,
+        traces_per_file,
+        chunk_bytes,
+        rtl_trace_dir_str,
+        mem_budget);
+    // Started by run_from_trace, after a classifier has been set
   }
 
   // Only make a CLINT (Core-Local INTerrupt controller) and PLIC (Platform-
@@ -191,11 +242,14 @@ sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
           std::shared_ptr<abstract_device_t> pg_ptr(pg);
           plic = std::static_pointer_cast<plic_t>(pg_ptr);
 
-          std::shared_ptr<ganged_device_t> gdev = std::make_shared<ganged_device_t>(pg_ptr);
+          std::shared_ptr<ganged_device_t> gdev =
+            std::make_shared<ganged_device_t>(pg_ptr, DEVICE_TICK_PERIOD);
           ganged_devs.push_back(gdev);
           add_device(device_base, gdev);
         } else {
-          std::shared_ptr<ganged_device_t> gdev = std::make_shared<ganged_device_t>(dev_ptr);
+          // Plugin devices may raise interrupts from tick
+          std::shared_ptr<ganged_device_t> gdev =
+            std::make_shared<ganged_device_t>(dev_ptr, DEVICE_TICK_PERIOD);
           ganged_devs.push_back(gdev);
           add_device(device_base, gdev);
         }
@@ -212,7 +266,8 @@ sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
   if (from_rtl_trace) {
     firesim_bootrom.resize(ROCKETCHIP_BOOTROM_SIZE);
     std::shared_ptr<rom_device_t> bootrom_ptr = std::make_shared<rom_device_t>(firesim_bootrom);
-    std::shared_ptr<ganged_device_t> rom_ptr = std::make_shared<ganged_device_t>(bootrom_ptr);
+    std::shared_ptr<ganged_device_t> rom_ptr =
+      std::make_shared<ganged_device_t>(bootrom_ptr, DEVICE_TICK_PERIOD);
     ganged_devs.push_back(rom_ptr);
     add_device(ROCKETCHIP_BOOTROM_BASE, rom_ptr);
   }
@@ -287,24 +342,54 @@ sim_lib_t::sim_lib_t(const cfg_t *cfg, bool halted,
 }
 
 sim_lib_t::~sim_lib_t() {
+  // Writes the time index of the replayed part of the trace, see trace_reader_t
+  delete trace_reader;
 }
 
 int sim_lib_t::run() {
+  // Nothing looks at the pc trace of a plain run unless it is written out
+  bb_trace_writer_t* bb_writer = nullptr;
+  if (!bb_trace_path.empty())
+    bb_writer = new bb_trace_writer_t(bb_trace_path);
+  set_trace_policy(bb_writer ? TRACE_POLICY_BB : TRACE_POLICY_NONE);
+  uint64_t insns = retired_insns();
+  auto run_start = std::chrono::steady_clock::now();
   while (target_running()) {
-    uint64_t tohost_req = check_tohost_req();
+    uint64_t tohost_req = take_tohost_req();
     if (tohost_req) {
       handle_tohost_req(tohost_req);
     } else {
-      if (debug || ctrlc_pressed)
+      if (debug || ctrlc_pressed) {
         interactive();
-      else
+      } else {
         step_target(INTERLEAVE, INTERLEAVE / INSNS_PER_RTC_TICK);
+        for (size_t i = 0; bb_writer && i < procs.size(); i++)
+          bb_writer->append(get_core(i)->step_bb_trace());
+      }
     }
     send_fromhost_req();
   }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+  insns = retired_insns() - insns;
+  printf("ran %" PRIu64 " instructions in %f s (%.2f MIPS)\n", insns, secs, insns / secs / 1e6);
+  if (bb_writer) {
+    uint64_t runs = bb_writer->entries();
+    if (bb_writer->close())
+      printf("basic block trace: %" PRIu64 " runs in %s\n", runs, bb_trace_path.c_str());
+    else
+      printf("basic block trace: failed to write %s\n", bb_trace_path.c_str());
+    delete bb_writer;
+  }
   return stop_sim();
 }
 
+uint64_t sim_lib_t::retired_insns() {
+  uint64_t insns = 0;
+  for (size_t i = 0; i < procs.size(); i++)
+    insns += procs[i]->get_state()->minstret->read();
+  return insns;
+}
+
 void sim_lib_t::init() {
   if (!debug && log)
     set_procs_debug(true);
@@ -313,14 +398,42 @@ void sim_lib_t::init() {
 
   // load the binary
   start();
+
+  // ganged_step runs once per RTL step, so it uses plain pointers to the
+  // cores instead of going through get_core, indexed by hartid
+  cores.assign(hart_proc.size(), nullptr);
+  for (size_t h = 0; h < hart_proc.size(); h++)
+    if (hart_proc[h] >= 0)
+      cores[h] = get_core(hart_proc[h]);
+
+  // Every ganged device but the clint, which follows the RTL time, is ticked
+  // every DEVICE_TICK_PERIOD steps starting at step 0, as ganged_step used to
+  tick_devs.clear();
+  tick_sched.clear();
+  for (auto& gdev : ganged_devs) {
+    if (gdev->tick_period == 0)
+      continue;
+    tick_sched.schedule((uint32_t)tick_devs.size(), 0);
+    tick_devs.push_back(gdev.get());
+  }
+  next_tick = tick_sched.next_due();
+
+  // tohost_addr is known once the binary is loaded
+  watch_htif();
+}
+
+void sim_lib_t::set_trace_policy(trace_policy_t policy) {
+  for (size_t i = 0; i < procs.size(); i++)
+    get_core(i)->set_trace_policy(policy);
 }
 
-void sim_lib_t::run_for(uint64_t steps) {
+void sim_lib_t::run_for(uint64_t steps, trace_policy_t policy) {
   uint64_t tot_step = 0;
   bool stalled = false;
+  set_trace_policy(policy);
 
   while (target_running() && tot_step < steps && !stalled) {
-    uint64_t tohost_req = check_tohost_req();
+    uint64_t tohost_req = take_tohost_req();
     if (tohost_req) {
       handle_tohost_req(tohost_req);
     } else {
@@ -329,10 +442,12 @@ void sim_lib_t::run_for(uint64_t steps) {
       step_target(cur_step, dev_step);
       for (int i = 0, nprocs = (int)procs.size(); i < nprocs; i++) {
         auto plib = dynamic_cast<processor_lib_t*>(procs[i]);
-        auto pst = plib->step_trace();
+        auto& pst = plib->step_trace();
         target_trace.insert(target_trace.end(), pst.begin(), pst.end());
-        tot_step += pst.size();
-        if (pst.size() == 0) {
+        auto& bbt = plib->step_bb_trace();
+        target_bb_trace.insert(target_bb_trace.end(), bbt.begin(), bbt.end());
+        tot_step += plib->step_insns();
+        if (plib->step_insns() == 0) {
           stalled = true;
           break;
         }
@@ -408,15 +523,42 @@ void sim_lib_t::handle_tohost_req(uint64_t req) {
 
 void sim_lib_t::send_fromhost_req() {
   try {
-    if (!fromhost_queue.empty() && !mem.read_uint64(fromhost_addr)) {
-      mem.write_uint64(fromhost_addr, to_target(fromhost_queue.front()));
-      fromhost_queue.pop();
+    if (!fromhost_queue.empty() && fromhost_acked) {
+      if (!mem.read_uint64(fromhost_addr)) {
+        mem.write_uint64(fromhost_addr, to_target(fromhost_queue.front()));
+        fromhost_queue.pop();
+      }
+      // Wait for the target to clear fromhost before looking again
+      fromhost_acked = false;
     }
   } catch (mem_trap_t& t) {
     bad_address("accessing fromhost", t.get_tval());
   }
 }
 
+// Starts watching the stores to tohost and fromhost. Their pages may already
+// be in the store TLB, so the TLBs are flushed. tohost is read once in case
+// the binary was loaded with a request in it.
+void sim_lib_t::watch_htif() {
+  htif_page_mask = ~(reg_t)(PGSIZE - 1);
+  tohost_page = tohost_addr ? (tohost_addr & htif_page_mask) : ~(reg_t)0;
+  fromhost_page = fromhost_addr ? (fromhost_addr & htif_page_mask) : ~(reg_t)0;
+  tohost_written = (tohost_addr != 0);
+  fromhost_acked = true;
+
+  for (int i = 0, nprocs = procs.size(); i < nprocs; i++) {
+    procs[i]->get_mmu()->flush_tlb();
+  }
+  debug_mmu->flush_tlb();
+}
+
+void sim_lib_t::htif_store(reg_t paddr, reg_t len) {
+  if (tohost_addr && paddr < tohost_addr + 8 && paddr + len > tohost_addr)
+    tohost_written = true;
+  if (fromhost_addr && paddr < fromhost_addr + 8 && paddr + len > fromhost_addr)
+    fromhost_acked = true;
+}
+
 void sim_lib_t::serialize_proto(std::string& msg) {
 #ifdef DEBUG_PROTOBUF
   printf("serializing\n");
@@ -584,6 +726,10 @@ void sim_lib_t::deserialize_proto(std::string& msg) {
   }
   debug_mmu->flush_tlb();
 
+  // The restored memory may hold requests that were never seen being stored
+  tohost_written = (tohost_addr != 0);
+  fromhost_acked = true;
+
   for (auto& addr_mem : mems) {
     auto mem = (mem_t*)addr_mem.second;
     std::map<reg_t, char*>& spm = mem->get_sparse_memory_map();
@@ -657,126 +803,271 @@ void sim_lib_t::deserialize_proto(std::string& msg) {
 
 }
 
-bool sim_lib_t::ganged_step(rtl_step_t step, int hartid) {
-  bool val       = step.val;
-  uint64_t time  = step.time;
-  uint64_t pc    = step.pc;
-  uint64_t insn  = step.insn;
-  bool except    = step.except;
-  bool intrpt    = step.intrpt;
-  int cause      = step.cause;
-  bool has_w     = step.has_w;
-  uint64_t wdata = step.wdata;
-  int priv       = step.priv;
+#define RTL_CKPT_MAGIC   "COSPKCKP"
+#define RTL_CKPT_VERSION 1
+
+// RTL checkpoint layout: rtl_ckpt_header_t followed by the proto
+struct rtl_ckpt_header_t {
+  char     magic[8];
+  uint32_t version;
+  uint32_t nprocs;
+  uint64_t time;
+  uint64_t processor_step_cnt;
+  uint64_t bytes;
+};
+
+bool sim_lib_t::save_rtl_ckpt(const std::string& path, uint64_t time) {
+  // Without the memory in the proto the checkpoint only lives in this process
+  assert(serialize_mem);
+
+  std::string proto;
+  serialize_proto(proto);
+
+  rtl_ckpt_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, RTL_CKPT_MAGIC, sizeof(hdr.magic));
+  hdr.version = RTL_CKPT_VERSION;
+  hdr.nprocs = (uint32_t)procs.size();
+  hdr.time = time;
+  hdr.processor_step_cnt = processor_step_cnt;
+  hdr.bytes = proto.size();
+
+  FILE* fp = fopen(path.c_str(), "wb");
+  if (fp == NULL)
+    return false;
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            fwrite(proto.data(), 1, proto.size(), fp) == proto.size();
+  ok &= (fclose(fp) == 0);
+  if (ok)
+    printf("saved RTL checkpoint at time %" PRIu64 " (step %" PRIu64 ") to %s\n",
+        time, processor_step_cnt, path.c_str());
+  return ok;
+}
 
-  std::set<reg_t> magic_addrs;
+bool sim_lib_t::load_rtl_ckpt(const std::string& path, uint64_t& time) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL)
+    return false;
+
+  rtl_ckpt_header_t hdr;
+  std::string proto;
+  bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            memcmp(hdr.magic, RTL_CKPT_MAGIC, sizeof(hdr.magic)) == 0 &&
+            hdr.version == RTL_CKPT_VERSION &&
+            hdr.nprocs == procs.size();
+  if (ok) {
+    proto.resize(hdr.bytes);
+    ok = fread(&proto[0], 1, proto.size(), fp) == proto.size();
+  }
+  fclose(fp);
+  if (!ok)
+    return false;
+
+  deserialize_proto(proto);
+  time = hdr.time;
+
+  // Every ticked device is due at the next multiple of its period, as if the
+  // replay had run from step 0
+  processor_step_cnt = hdr.processor_step_cnt;
+  tick_sched.clear();
+  for (size_t id = 0; id < tick_devs.size(); id++) {
+    uint64_t period = tick_devs[id]->tick_period;
+    tick_sched.schedule((uint32_t)id, (processor_step_cnt + period - 1) / period * period);
+  }
+  next_tick = tick_sched.next_due();
 
-  processor_t* proc = get_core(hartid);
-  state_t* s = proc->get_state();
-  uint64_t s_pc = s->pc;
+  printf("loaded RTL checkpoint at time %" PRIu64 " (step %" PRIu64 ") from %s\n",
+      time, processor_step_cnt, path.c_str());
+  return true;
+}
+
+// Ticks the devices that are due at processor_step_cnt and schedules their
+// next tick a period later
+void sim_lib_t::tick_devices() {
+  tick_event_t ev;
+  while (tick_sched.pop_due(processor_step_cnt, ev)) {
+    ganged_device_t* d = tick_devs[ev.id];
+    flight.record(FLIGHT_DEV_TICK, 0, processor_step_cnt, ev.id);
+    d->tick(1);
+    tick_sched.schedule(ev.id, ev.due + d->tick_period);
+  }
+  next_tick = tick_sched.next_due();
+}
 
-  uint64_t interrupt_cause = cause & 0x7FFFFFFFFFFFFFFF;
+// Ticks every device but the clint out of turn, the plic included and not
+// only the scheduled devices, so that a pending external interrupt can reach
+// the plic. The next scheduled ticks stay in place.
+void sim_lib_t::tick_devices_now() {
+  for (int i = 1, cnt = devices.size(); i < cnt; i++) {
+    auto& d = devices[i];
+    d->tick(1);
+  }
+}
+
+// Cold path of ganged_step: raises the interrupt the RTL took so that the
+// step below takes it as well
+bool sim_lib_t::ganged_interrupt(const rtl_step_t& step, int hartid) {
+  state_t* s = cores[hartid]->get_state();
+  uint64_t interrupt_cause = step.cause & 0x7FFFFFFFFFFFFFFF;
   bool ssip_interrupt = interrupt_cause == 0x1;
   bool msip_interrupt = interrupt_cause == 0x3;
   bool stip_interrupt = interrupt_cause == 0x5;
   bool mtip_interrupt = interrupt_cause == 0x7;
   bool seip_interrupt = interrupt_cause == 0x9;
   bool debug_interrupt = interrupt_cause == 0xe;
-
-  // If the interrupt is set in RTL sim...
-  if (intrpt) {
-    if (ssip_interrupt || stip_interrupt) {
-      // do nothing
-    } else if (msip_interrupt) {
-      s->mip->backdoor_write_with_mask(MIP_MSIP, MIP_MSIP);
-    } else if (mtip_interrupt) {
-      s->mip->backdoor_write_with_mask(MIP_MTIP, MIP_MTIP);
-    } else if (debug_interrupt) {
-      // don't execute instructions
-    } else if (seip_interrupt) {
-      bool has_pending_interrupt = this->plic->alert_core_external_interrupt(hartid);
-      if (!has_pending_interrupt) {
-        for (int i = 1, cnt = devices.size(); i < cnt; i++) {
-          auto& d = devices[i];
-          d->tick(1);
-        }
-        bool retry_plic_interrupt = this->plic->alert_core_external_interrupt(hartid);
-        if (!retry_plic_interrupt) {
-          printf("Spike does not have any pending interrupts\n");
-          printf("TRACE time: %" PRIu64 " v: %d pc: 0x%" PRIx64 " insn: 0x%" PRIx64 " e: %d i: %d c: %d hw: %d wd: %" PRIu64 " prv: %d\n",
-              time, val, pc, insn, except, intrpt, cause, has_w, wdata, priv);
-          return false;
-        }
+  flight.record(FLIGHT_INTERRUPT, hartid, processor_step_cnt, interrupt_cause);
+
+  if (ssip_interrupt || stip_interrupt) {
+    // do nothing
+  } else if (msip_interrupt) {
+    s->mip->backdoor_write_with_mask(MIP_MSIP, MIP_MSIP);
+  } else if (mtip_interrupt) {
+    s->mip->backdoor_write_with_mask(MIP_MTIP, MIP_MTIP);
+  } else if (debug_interrupt) {
+    // don't execute instructions
+  } else if (seip_interrupt) {
+    bool has_pending_interrupt = this->plic->alert_core_external_interrupt(hartid);
+    if (!has_pending_interrupt) {
+      tick_devices_now();
+      bool retry_plic_interrupt = this->plic->alert_core_external_interrupt(hartid);
+      if (!retry_plic_interrupt) {
+        printf("Spike does not have any pending interrupts\n");
+        printf("TRACE time: %" PRIu64 " v: %d pc: 0x%" PRIx64 " insn: 0x%" PRIx64 " e: %d i: %d c: %d hw: %d wd: %" PRIu64 " prv: %d\n",
+            step.time, step.val, step.pc, step.insn, step.except, step.intrpt, step.cause, step.has_w, step.wdata, step.priv);
+        return false;
       }
-    } else {
-      printf("Unknown interrupt\n");
-      printf("TRACE time: %" PRIu64 " v: %d pc: 0x%" PRIx64 " insn: 0x%" PRIx64 " e: %d i: %d c: %d hw: %d wd: %" PRIu64 " prv: %d\n",
-          time, val, pc, insn, except, intrpt, cause, has_w, wdata, priv);
-      return false;
     }
+  } else {
+    printf("Unknown interrupt\n");
+    printf("TRACE time: %" PRIu64 " v: %d pc: 0x%" PRIx64 " insn: 0x%" PRIx64 " e: %d i: %d c: %d hw: %d wd: %" PRIu64 " prv: %d\n",
+        step.time, step.val, step.pc, step.insn, step.except, step.intrpt, step.cause, step.has_w, step.wdata, step.priv);
+    return false;
   }
+  return true;
+}
 
-  // WFI instructions are noops in RTL.
-  // To avoid executing wfi instruction multiple times in functional sim,
-  // we want to clear the wfi signal.
-  if (val || except || intrpt) {
-    if (processor_step_cnt++ % DEVICE_TICK_PERIOD == 0) {
-      // ignore clint
-      for (int i = 1, cnt = devices.size(); i < cnt; i++) {
-        auto& d = devices[i];
-        d->tick(1);
-      }
-    }
+void sim_lib_t::dump_flight_recorder() {
+  if (flight.dump(flight_path))
+    printf("flight recorder: last %zu of %" PRIu64 " records in %s\n",
+        flight.size(), flight.recorded(), flight_path.c_str());
+  else
+    printf("flight recorder: failed to write %s\n", flight_path.c_str());
+}
 
-    proc->clear_waiting_for_interrupt();
-    proc->step(1);
+void sim_lib_t::print_pc_mismatch(const rtl_step_t& step, int hartid) {
+  state_t* s = cores[hartid]->get_state();
+  printf("!!!!!!!!!!!! %" PRIu64 " PC mismatch spike %" PRIx64 " != DUT %" PRIx64 "\n", step.time, s->pc, step.pc);
+  printf("spike mstatus is %lx\n", s->mstatus->read());
+  printf("spike mcause is %lx\n", s->mcause->read());
+  printf("spike mtval is %lx\n" , s->mtval->read());
+  printf("spike mtinst is %lx\n", s->mtinst->read());
+  printf("spike mepc is %lx\n", s->mepc->read());
+  printf("spike mtvec is %lx\n", s->mtvec->read());
+  printf("spike satp is %lx\n", s->satp->read());
+  for (int i = 0; i < NXPR; i++) {
+    printf("r %2d = 0x%" PRIx64 "\n", i, s->XPR[i]);
   }
+}
 
-  if (val && !except) {
-    if (s_pc != pc) {
-      printf("!!!!!!!!!!!! %lld PC mismatch spike %lx != DUT %llx\n", time, s->pc, pc);
-      printf("spike mstatus is %lx\n", s->mstatus->read());
-      printf("spike mcause is %lx\n", s->mcause->read());
-      printf("spike mtval is %lx\n" , s->mtval->read());
-      printf("spike mtinst is %lx\n", s->mtinst->read());
-      printf("spike mepc is %lx\n", s->mepc->read());
-      printf("spike mtvec is %lx\n", s->mtvec->read());
-      printf("spike satp is %lx\n", s->satp->read());
-      for (int i = 0; i < NXPR; i++) {
-        printf("r %2d = 0x%" PRIx64 "\n", i, s->XPR[i]);
-      }
-      return false;
+// Side effects of the stores of the last instruction of the hart
+void sim_lib_t::ganged_mem_writes(int hartid) {
+  state_t* s = cores[hartid]->get_state();
+  for (auto& memwrite : s->log_mem_write) {
+    reg_t waddr = std::get<0>(memwrite);
+    uint64_t w_data = std::get<1>(memwrite);
+    flight.record(FLIGHT_MEM_WRITE, hartid, processor_step_cnt, waddr, w_data, 0, 0,
+                  std::get<2>(memwrite));
+
+    // If the store address matches the CLINT, lower the interrupt signal
+    if ((waddr == CLINT_BASE + 4*hartid) && w_data == 0) {
+      s->mip->backdoor_write_with_mask(MIP_MSIP, 0);
+    }
+    if ((waddr == CLINT_BASE + 0x4000 + 4*hartid)) {
+      s->mip->backdoor_write_with_mask(MIP_MTIP, 0);
     }
 
-    auto& mem_write = s->log_mem_write;
-    auto& log = s->log_reg_write;
-    auto& mem_read = s->log_mem_read;
+    // Try to remember magic_mem addrs, and ignore these in the future
+    if (unlikely(waddr == tohost_addr) &&
+        w_data >= ROCKETCHIP_MEM0_BASE &&
+        w_data < (ROCKETCHIP_MEM0_BASE + ROCKETCHIP_MEM0_SIZE)) {
+      magic_addrs.insert(w_data);
+    }
+  }
+}
 
-    for (auto memwrite : mem_write) {
-      reg_t waddr = std::get<0>(memwrite);
-      uint64_t w_data = std::get<1>(memwrite);
+// Plain retirements go through processor_lib_t::step_lockstep in one call.
+// The step at which a device is ticked is left to ganged_step and a batch
+// ends before the next one, so the devices see the same ticks.
+size_t sim_lib_t::ganged_run(const rtl_step_t* steps, size_t n, int hartid) {
+  size_t plain = 0;
+  if (lockstep_min_steps != 0 && processor_step_cnt < next_tick) {
+    size_t limit = (size_t)std::min((uint64_t)n, next_tick - processor_step_cnt);
+    while (plain < limit && steps[plain].val && !steps[plain].except && !steps[plain].intrpt)
+      plain++;
+  }
 
-      // If the store address matches the CLINT, lower the interrupt signal
-      if ((waddr == CLINT_BASE + 4*hartid) && w_data == 0) {
-        s->mip->backdoor_write_with_mask(MIP_MSIP, 0);
-      }
-      if ((waddr == CLINT_BASE + 0x4000 + 4*hartid)) {
-        s->mip->backdoor_write_with_mask(MIP_MTIP, 0);
+  if (plain != 0 && plain >= lockstep_min_steps) {
+    size_t done = cores[hartid]->step_lockstep(steps, plain);
+    if (done > 0) {
+      for (size_t i = 0; i < done; i++) {
+        const rtl_step_t& st = steps[i];
+        flight.record(FLIGHT_RTL_STEP, hartid, processor_step_cnt + i + 1,
+                      st.time, st.pc, st.wdata, st.pc, st.cause,
+                      FLIGHT_VAL | (st.has_w ? FLIGHT_HAS_W : 0) | FLIGHT_BATCH);
       }
+      processor_step_cnt += done;
+      lockstep_step_cnt += done;
+      ganged_mem_writes(hartid);
+      return done;
+    }
+  }
+  // ganged_step reports the mismatch if the batch stopped at the first step
+  return ganged_step(steps[0], hartid) ? 1 : 0;
+}
 
-      // Try to remember magic_mem addrs, and ignore these in the future
-      if (waddr == tohost_addr &&
-          w_data >= ROCKETCHIP_MEM0_BASE &&
-          w_data < (ROCKETCHIP_MEM0_BASE + ROCKETCHIP_MEM0_SIZE)) {
-        magic_addrs.insert(w_data);
-      }
+// Runs once per RTL step, so everything it needs is cached by init() and
+// the rare cases (interrupts, mismatches) live in separate functions
+bool sim_lib_t::ganged_step(const rtl_step_t& step, int hartid) {
+  processor_lib_t* proc = cores[hartid];
+  state_t* s = proc->get_state();
+  uint64_t s_pc = s->pc;
+
+  // If the interrupt is set in RTL sim...
+  if (unlikely(step.intrpt) && !ganged_interrupt(step, hartid))
+    return false;
+
+  // WFI instructions are noops in RTL.
+  // To avoid executing wfi instruction multiple times in functional sim,
+  // we want to clear the wfi signal.
+  if (likely(step.val || step.except || step.intrpt)) {
+    if (unlikely(processor_step_cnt >= next_tick))
+      tick_devices();
+    processor_step_cnt++;
+    proc->clear_waiting_for_interrupt();
+    proc->step(1);
+  }
+  flight.record(FLIGHT_RTL_STEP, hartid, processor_step_cnt, step.time, step.pc,
+                step.wdata, s_pc, step.cause,
+                (step.val ? FLIGHT_VAL : 0) | (step.except ? FLIGHT_EXCEPT : 0) |
+                (step.intrpt ? FLIGHT_INTRPT : 0) | (step.has_w ? FLIGHT_HAS_W : 0));
+
+  if (likely(step.val && !step.except)) {
+    if (unlikely(s_pc != step.pc)) {
+      print_pc_mismatch(step, hartid);
+      return false;
     }
 
+    ganged_mem_writes(hartid);
+
+    auto& log = s->log_reg_write;
     for (auto &regwrite: log) {
       int rd = regwrite.first >> 4;
       int type = regwrite.first & 0xf;
-      if (rd != 0 && type == 0) {
-          s->XPR.write(rd, wdata);
+      bool overwrite = (rd != 0 && type == 0);
+      flight.record(FLIGHT_REG_WRITE, hartid, processor_step_cnt, regwrite.first,
+                    regwrite.second.v[0], overwrite ? step.wdata : 0);
+      if (overwrite) {
+          s->XPR.write(rd, step.wdata);
       }
     }
   }
@@ -812,37 +1103,75 @@ void sim_lib_t::parse_line_into_rtltrace(const char* line, rtl_step_t& step) {
 }
 
 int sim_lib_t::run_from_trace() {
-  // TODO : multicore support
-  int hartid = 0;
   this->configure_log(true, true);
-  this->get_core(hartid)->get_state()->pc = ROCKETCHIP_RESET_VECTOR;
+  set_trace_policy(TRACE_POLICY_NONE);
+  if (rtl_ckpt_load_path.empty()) {
+    for (size_t i = 0; i < nprocs(); i++)
+      get_core(i)->get_state()->pc = ROCKETCHIP_RESET_VECTOR;
+  } else {
+    uint64_t time;
+    if (!load_rtl_ckpt(rtl_ckpt_load_path, time)) {
+      printf("failed to load RTL checkpoint %s\n", rtl_ckpt_load_path.c_str());
+      exit(1);
+    }
+    trace_reader->seek(time);
+  }
 
-  uint64_t bufid = 0;
+  uint64_t ckpt_time = rtl_ckpt_save_path.empty() ? UINT64_MAX : rtl_ckpt_save_time;
+  trace_reader->start();
   uint64_t cnt = 0;
+  trace_run_t run;
+  auto replay_start = std::chrono::steady_clock::now();
   while (target_running()) {
-    trace_buffer_t* buf = trace_reader->cur_buffer();
-    while (!buf->can_consume()) {
-      ;
+    if (!trace_reader->next(run)) {
+      printf("reached the end of the RTL trace\n");
+      break;
     }
-    while (!buf->empty()) {
-      if ((cnt++ & TOHOST_CHECK_PERIOD) == 0) {
-        uint64_t tohost_req = check_tohost_req();
-        if (tohost_req)
-          handle_tohost_req(tohost_req);
+    for (rtl_step_t* step = run.begin(); step != run.end(); ) {
+      uint64_t tohost_req = take_tohost_req();
+      if (unlikely(tohost_req))
+        handle_tohost_req(tohost_req);
+
+      // Runs stop short of the checkpoint, which is saved between two steps
+      rtl_step_t* end = run.end();
+      if (unlikely(ckpt_time != UINT64_MAX)) {
+        end = std::lower_bound(step, end, ckpt_time,
+            [](const rtl_step_t& s, uint64_t t) { return s.time < t; });
+        if (end == step) {
+          if (!save_rtl_ckpt(rtl_ckpt_save_path, step->time)) {
+            printf("failed to save RTL checkpoint %s\n", rtl_ckpt_save_path.c_str());
+            exit(1);
+          }
+          ckpt_time = UINT64_MAX;
+          end = run.end();
+        }
       }
 
-      rtl_step_t& step = buf->pop_front();
-      bool success = ganged_step(step, hartid);
-      if (!success) {
-        printf("ganged simulation failed COSPIKE-%d-%" PRIu64 ".gz\n", hartid, bufid);
-        step.print();
+      // A batch ends after a store to tohost, which is handled right away
+      size_t done = ganged_run(step, end - step, run.hartid);
+      if (done == 0) {
+        printf("ganged simulation failed on hart %d\n", run.hartid);
+        step->print();
+        dump_flight_recorder();
         assert(false);
       }
+      step += done;
+      cnt += done;
     }
-    buf->done_consume();
-    trace_reader->pop_buffer();
-    bufid++;
   }
+  if (ckpt_time != UINT64_MAX)
+    printf("the replay stopped before the RTL checkpoint time %" PRIu64 "\n", ckpt_time);
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count();
+  printf("replayed %" PRIu64 " RTL steps in %f s (%.0f steps/s)\n", cnt, secs, cnt / secs);
+  printf("lockstep batches replayed %" PRIu64 " steps (%.1f%%)\n",
+      lockstep_step_cnt, cnt ? 100.0 * lockstep_step_cnt / cnt : 0.0);
+  printf("trace reader stalls (s) consumer: %f producer: %f\n",
+      trace_reader->consumer_stall_ns() / 1e9,
+      trace_reader->producer_stall_ns() / 1e9);
+  printf("trace reader depth: %d (max %d) decode threads: %d (max %d)\n",
+      trace_reader->depth(), trace_reader->max_depth(),
+      trace_reader->active_threads(), trace_reader->max_active_threads());
+  printf("trace reader dropped bubbles: %" PRIu64 "\n", trace_reader->bubbles());
   return 0;
 }
 
@@ -24,7 +24,9 @@
 #include "ganged_devices.h"
 #include "processor_lib.h"
 #include "../lib/trace.h"
-#include "../lib/trace_reader.h"
+#include "../lib/trace_merge.h"
+#include "../lib/tick_sched.h"
+#include "../lib/flight_recorder.h"
 
 
 /* #define DEBUG_MEM */
@@ -37,8 +39,9 @@ typedef std::vector<char*>     pagepool;
 struct rtl_trace_cfg_t {
   const char* rtl_trace_dir;
   int nthreads;
-  size_t max_file_bytes;
+  size_t chunk_bytes;
   size_t traces_per_file;
+  size_t mem_budget;
 };
 
 class sim_lib_t : public sim_t {
@@ -58,7 +61,13 @@ public:
 
   virtual int run();
   virtual int run_from_trace();
-  void run_for(uint64_t steps);
+  // Steps the harts for steps instructions, appending what policy records
+  // to run_trace() (or run_bb_trace())
+  void run_for(uint64_t steps, trace_policy_t policy = TRACE_POLICY_FULL);
+  void set_trace_policy(trace_policy_t policy);
+
+  // minstret summed over the harts, run() reports MIPS with it
+  uint64_t retired_insns();
 
   void init();
   bool target_running();
@@ -74,10 +83,46 @@ public:
   void handle_tohost_req(uint64_t req);
   void send_fromhost_req();
 
+  // tohost and fromhost are watched through the store path of mmu_lib_t
+  // instead of being polled: stores of the target to their pages never
+  // refill the store TLB, and htif_store notes which of the two it wrote.
+  bool htif_watched(reg_t paddr, reg_t len) const {
+    return (tohost_addr && paddr < tohost_addr + 8 && paddr + len > tohost_addr) ||
+           (fromhost_addr && paddr < fromhost_addr + 8 && paddr + len > fromhost_addr);
+  }
+  bool htif_page(reg_t paddr) const {
+    reg_t page = paddr & htif_page_mask;
+    return page == tohost_page || page == fromhost_page;
+  }
+  void htif_store(reg_t paddr, reg_t len);
+
+  // check_tohost_req, only once the target stored to tohost
+  uint64_t take_tohost_req() {
+    if (likely(!tohost_written))
+      return 0;
+    tohost_written = false;
+    return check_tohost_req();
+  }
+
   // checkpointing apis
   void serialize_proto(std::string& msg);
   void deserialize_proto(std::string& msg);
 
+  // RTL checkpoints: the serialize_proto state (memory included) before the
+  // RTL step at time, along with processor_step_cnt that the device ticks
+  // follow. The state of the devices that serialize_proto skips (the uart)
+  // is not saved. Return false if the file cannot be written or read.
+  bool save_rtl_ckpt(const std::string& path, uint64_t time);
+  bool load_rtl_ckpt(const std::string& path, uint64_t& time);
+
+  // When set, run_from_trace saves an RTL checkpoint to rtl_ckpt_save_path
+  // before the first step at or after rtl_ckpt_save_time, and starts from
+  // the checkpoint in rtl_ckpt_load_path instead of the reset vector, with
+  // the trace seeked to its time (see merged_trace_reader_t::seek)
+  std::string rtl_ckpt_save_path;
+  uint64_t rtl_ckpt_save_time = 0;
+  std::string rtl_ckpt_load_path;
+
   bool serialize_mem = true;
   bool serialize_called = false;
 
@@ -91,16 +136,48 @@ public:
   pagemap mm_ckpt; // host addr -> ckpt addr
 
   trace_t& run_trace() { return target_trace; }
-  void clear_run_trace() { target_trace.clear(); }
+  bb_trace_t& run_bb_trace() { return target_bb_trace; }
+  void clear_run_trace() { target_trace.clear(); target_bb_trace.clear(); }
+
+  // When set, run() writes the basic block trace of the harts to this
+  // BBTRACE file (see trace_bb.h and expand_bb_trace)
+  std::string bb_trace_path;
+
+  // Shortest run of plain RTL retirements that ganged_run replays with
+  // processor_lib_t::step_lockstep, 0 steps every retirement on its own.
+  // Shorter runs are not worth a batch.
+  static const size_t LOCKSTEP_MIN_STEPS = 8;
+  size_t lockstep_min_steps = LOCKSTEP_MIN_STEPS;
+
+  // Steps of ganged_run that went through step_lockstep
+  uint64_t lockstep_step_cnt = 0;
+
   processor_lib_t* get_core(size_t i) { 
     return dynamic_cast<processor_lib_t*>(procs.at(i)); 
   }
+
+  // RISC-V hartids, as found in the RTL trace, need not be proc indices:
+  // hart_proc maps a hartid to its index in procs, -1 if it is not simulated
+  std::vector<int> hart_proc;
+  processor_lib_t* get_hart_core(int hartid) {
+    return get_core(hart_proc.at(hartid));
+  }
   reg_t get_asid(int hartid) {
-    return get_core(hartid)->get_asid();
+    return get_hart_core(hartid)->get_asid();
   }
 
   void parse_line_into_rtltrace(const char* line, rtl_step_t& step);
-  bool ganged_step(rtl_step_t step, int hartid);
+  bool ganged_step(const rtl_step_t& step, int hartid);
+
+  // Replays steps[0..n) up to the first one that needs ganged_step, in one
+  // batch when the run is long enough. Returns the number of steps replayed,
+  // at least 1, or 0 when the first step does not match the RTL.
+  size_t ganged_run(const rtl_step_t* steps, size_t n, int hartid);
+
+  // Writes the last records of the ganged replay to flight_path, see
+  // decode_flight_recorder
+  void dump_flight_recorder();
+  std::string flight_path = "FLIGHT-RECORDER.bin";
 
 private:
   friend class processor_t;
@@ -108,6 +185,7 @@ private:
   friend class sim_t;
 
   trace_t target_trace;
+  bb_trace_t target_bb_trace;
 
   google::protobuf::Arena* arena;
 
@@ -115,13 +193,45 @@ private:
   std::function<void(reg_t)> fromhost_callback;
 
   std::vector<std::shared_ptr<ganged_device_t>> ganged_devs;
-  const uint64_t DEVICE_TICK_PERIOD = 1000;
+  static constexpr uint64_t DEVICE_TICK_PERIOD = 1000;
   uint64_t processor_step_cnt = 0;
 
+  // Device ticks keyed by processor_step_cnt, ids index tick_devs.
+  // next_tick caches tick_sched.next_due() for ganged_step.
+  std::vector<ganged_device_t*> tick_devs;
+  tick_sched_t tick_sched;
+  uint64_t next_tick = TICK_SCHED_NEVER;
+
+  // Steps, writebacks and device events of the ganged replay
+  static constexpr size_t FLIGHT_RECORDER_SLOTS = 1 << 16;
+  flight_recorder_t flight{FLIGHT_RECORDER_SLOTS};
+
+  // Cached by init() for ganged_step, indexed by hartid (nullptr for the
+  // hartids that are not simulated)
+  std::vector<processor_lib_t*> cores;
+
+  // Magic memory handed to the host through tohost
+  std::set<reg_t> magic_addrs;
+
+  // Set up by watch_htif() once the binary is loaded. fromhost_acked is
+  // set when the target clears fromhost, until then nothing is sent.
+  reg_t htif_page_mask = 0;
+  reg_t tohost_page = ~(reg_t)0;
+  reg_t fromhost_page = ~(reg_t)0;
+  bool tohost_written = false;
+  bool fromhost_acked = true;
+
+  void watch_htif();
+
+  void tick_devices();
+  void tick_devices_now();
+  void ganged_mem_writes(int hartid);
+  bool ganged_interrupt(const rtl_step_t& step, int hartid);
+  void print_pc_mismatch(const rtl_step_t& step, int hartid);
+
 protected:
-  trace_reader_t* trace_reader = nullptr;
+  merged_trace_reader_t* trace_reader = nullptr;
 
-  uint64_t TOHOST_CHECK_PERIOD = 0xfff;
   uint64_t ROCKETCHIP_RESET_VECTOR  = 0x10000;
   size_t   ROCKETCHIP_BOOTROM_BASE  = 0x10000;
   size_t   ROCKETCHIP_BOOTROM_SIZE  = 0x10000;
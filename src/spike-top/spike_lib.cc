@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <string>
 #include <memory>
@@ -82,7 +83,23 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --dm-no-impebreak     Debug module won't support implicit ebreak in program buffer\n");
   fprintf(stderr, "  --blocksz=<size>      Cache block size (B) for CMO operations(powers of 2) [default 64]\n");
   fprintf(stderr, "  --ckpt-step=<size>    Steps to run before serialize & reload (valid only when > 0)\n");
-  fprintf(stderr, "  --rtl-cfg=<dir:nthreads:traces_per_file:max_file_bytes> (Trace directory):(nthreads to decompress):(max insns per file):(max uncompressed file bytes)\n");
+  fprintf(stderr, "  --bb-trace=<file>     Write a basic block compressed pc trace of the run (see expand_bb_trace)\n");
+  fprintf(stderr, "  --lockstep-min=<n>    Shortest run of plain RTL retirements replayed in one batch, 0 to\n");
+  fprintf(stderr, "                        replay every retirement with step(1) [default %zu]\n",
+          sim_lib_t::LOCKSTEP_MIN_STEPS);
+  fprintf(stderr, "  --rtl-cfg=<dir:nthreads:traces_per_file[:chunk_bytes[:budget_mb]]>\n");
+  fprintf(stderr, "                        Replay the RTL commit trace, empty fields keep their defaults\n");
+  fprintf(stderr, "                          dir              COSPIKE-TRACE directory\n");
+  fprintf(stderr, "                          nthreads         Decompression threads [default 0, all cores]\n");
+  fprintf(stderr, "                          traces_per_file  Instructions per trace file\n");
+  fprintf(stderr, "                          chunk_bytes      Decompression chunk size, up to %d [default %d]\n",
+          TRACE_MAX_CHUNK_BYTES, TRACE_DEFAULT_CHUNK_BYTES);
+  fprintf(stderr, "                          budget_mb        Trace reader memory budget in MB [default %llu]\n",
+          TRACE_READER_MEM_BUDGET >> 20);
+  fprintf(stderr, "  --rtl-ckpt-save=<time>:<file>\n");
+  fprintf(stderr, "                        Save a checkpoint before the first RTL step at or after <time>\n");
+  fprintf(stderr, "  --rtl-ckpt-load=<file>\n");
+  fprintf(stderr, "                        Replay the RTL trace from a saved checkpoint instead of from reset\n");
 
   exit(exit_code);
 }
@@ -466,10 +483,33 @@ int main(int argc, char** argv)
   parser.option(0, "ckpt-step", 1, [&](const char* s) {
       ckpt_step = strtoull(s, 0, 0);
   });
+  size_t lockstep_min_steps = sim_lib_t::LOCKSTEP_MIN_STEPS;
+  parser.option(0, "lockstep-min", 1, [&](const char* s){
+      lockstep_min_steps = strtoull(s, 0, 0);
+  });
+  const char* bb_trace_path = NULL;
+  parser.option(0, "bb-trace", 1, [&](const char* s){
+      bb_trace_path = s;
+  });
   const char* rtl_cfg_char = NULL;
   parser.option(0, "rtl-cfg", 1, [&](const char* s){
       rtl_cfg_char = s;
   });
+  uint64_t rtl_ckpt_save_time = 0;
+  const char* rtl_ckpt_save_path = NULL;
+  parser.option(0, "rtl-ckpt-save", 1, [&](const char* s){
+      const char* sep = strchr(s, ':');
+      if (sep == NULL) {
+        fprintf(stderr, "--rtl-ckpt-save expects <time>:<file>\n");
+        exit(-1);
+      }
+      rtl_ckpt_save_time = strtoull(s, 0, 0);
+      rtl_ckpt_save_path = sep + 1;
+  });
+  const char* rtl_ckpt_load_path = NULL;
+  parser.option(0, "rtl-ckpt-load", 1, [&](const char* s){
+      rtl_ckpt_load_path = s;
+  });
   const char* objdump_file = NULL;
   parser.option(0, "objdump", 1, [&](const char* s){
       objdump_file = s;
@@ -570,6 +610,15 @@ int main(int argc, char** argv)
 
   s.set_debug(debug);
   s.configure_log(log, log_commits);
+  if (bb_trace_path)
+    s.bb_trace_path = bb_trace_path;
+  s.lockstep_min_steps = lockstep_min_steps;
+  if (rtl_ckpt_save_path) {
+    s.rtl_ckpt_save_path = rtl_ckpt_save_path;
+    s.rtl_ckpt_save_time = rtl_ckpt_save_time;
+  }
+  if (rtl_ckpt_load_path)
+    s.rtl_ckpt_load_path = rtl_ckpt_load_path;
 
   s.init();
   int return_code;
@@ -584,7 +633,7 @@ int main(int argc, char** argv)
     return_code = s.run();
   } else { // checkpoint, load, run
     std::string proto;
-    s.run_for(ckpt_step);
+    s.run_for(ckpt_step, TRACE_POLICY_NONE);
     s.serialize_proto(proto);
     fprintf(stdout, "======= serialization done   =======\n");
     fflush(stdout);
@@ -0,0 +1,130 @@
+#include <map>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <optional>
+#include <inttypes.h>
+#include "../profiler/pc_event_table.h"
+
+using namespace std::chrono;
+using namespace profiler;
+
+#define KERNEL_TEXT_BASE  0xffffffff80000000ULL
+#define KERNEL_TEXT_BYTES (16 << 20)
+#define NLOOKUPS          (10 * 1000 * 1000)
+#define CHUNK_ENTRIES     100000
+#define SCAN_ITERS        200
+
+// Lookups the profiler did before pc_event_table_t: a linear scan of the
+// start and exit pcs, then a map lookup for the function
+struct linear_lookup_t {
+  std::vector<addr_t> starts;
+  std::vector<addr_t> exits;
+  std::map<addr_t, function_t*> funcs;
+
+  std::optional<addr_t> find(const std::vector<addr_t>& v, addr_t pc) {
+    for (auto& x : v) {
+      if (x == pc) return pc;
+    }
+    return {};
+  }
+};
+
+// A retired instruction stream: mostly sequential, with a jump every few
+// instructions, and every hooked pc visited once in a while
+static std::vector<addr_t> gen_pcs(const std::vector<addr_t>& hooked, std::mt19937_64& rng) {
+  std::vector<addr_t> pcs(NLOOKUPS);
+  addr_t pc = KERNEL_TEXT_BASE;
+  for (auto& x : pcs) {
+    if (rng() % 1000 == 0)
+      pc = hooked[rng() % hooked.size()];
+    else if (rng() % 8 == 0)
+      pc = KERNEL_TEXT_BASE + 4 * (rng() % (KERNEL_TEXT_BYTES / 4));
+    else
+      pc += 4;
+    x = pc;
+  }
+  return pcs;
+}
+
+static void bench(size_t nhooked) {
+  std::mt19937_64 rng(nhooked);
+  pc_event_table_t table;
+  linear_lookup_t linear;
+  std::vector<addr_t> hooked;
+
+  // One start and a few exits per hooked function
+  while (hooked.size() < nhooked) {
+    addr_t start = KERNEL_TEXT_BASE + 4 * (rng() % (KERNEL_TEXT_BYTES / 4));
+    function_t* f = (function_t*)(uintptr_t)(16 * (1 + hooked.size()));
+    pc_event_t& e = table.insert(start);
+    e.is_start = true;
+    e.func = f;
+    linear.starts.push_back(start);
+    linear.funcs[start] = f;
+    hooked.push_back(start);
+    for (int i = 1 + rng() % 3; i > 0 && hooked.size() < nhooked; i--) {
+      addr_t exit = start + 4 * (1 + rng() % 256);
+      table.insert(exit).is_exit = true;
+      linear.exits.push_back(exit);
+      hooked.push_back(exit);
+    }
+  }
+  std::vector<addr_t> pcs = gen_pcs(hooked, rng);
+
+  uint64_t hits = 0;
+  auto start = high_resolution_clock::now();
+  for (auto pc : pcs) {
+    const pc_event_t* e = table.lookup(pc);
+    if (e != nullptr && (e->is_start ? e->func != nullptr : e->is_exit))
+      hits++;
+  }
+  auto end = high_resolution_clock::now();
+  double table_ns = duration_cast<nanoseconds>(end - start).count() / (double)pcs.size();
+
+  // The linear scan is too slow to go through all pcs with many hooks
+  size_t nlinear = std::min(pcs.size(), (size_t)(2e9 / (nhooked + 100)));
+  uint64_t linear_hits = 0;
+  start = high_resolution_clock::now();
+  for (size_t i = 0; i < nlinear; i++) {
+    addr_t pc = pcs[i];
+    auto sa = linear.find(linear.starts, pc);
+    if (sa.has_value()) {
+      if (linear.funcs[sa.value()] != nullptr)
+        linear_hits++;
+    } else if (linear.find(linear.exits, pc).has_value()) {
+      linear_hits++;
+    }
+  }
+  end = high_resolution_clock::now();
+  double linear_ns = duration_cast<nanoseconds>(end - start).count() / (double)nlinear;
+
+  // Chunks of profiler_t::run, which mostly have no hooks at all
+  std::vector<trace_entry_t> chunk(CHUNK_ENTRIES);
+  addr_t pc = KERNEL_TEXT_BASE + KERNEL_TEXT_BYTES;
+  for (auto& x : chunk) {
+    x = { pc, 0, 0 };
+    pc += 4;
+  }
+  std::vector<size_t> exits;
+  start = high_resolution_clock::now();
+  for (int i = 0; i < SCAN_ITERS; i++) {
+    exits.clear();
+    if (table.scan(chunk.data(), chunk.size(), exits) != chunk.size())
+      hits++;
+  }
+  end = high_resolution_clock::now();
+  double scan_secs = duration_cast<nanoseconds>(end - start).count() / 1e9;
+  double scan_gbps = (double)CHUNK_ENTRIES * sizeof(trace_entry_t) * SCAN_ITERS / scan_secs / 1e9;
+
+  printf("%6zu hooked pcs: table %6.2f ns/pc, linear %10.2f ns/pc, %" PRIu64 " hits (%" PRIu64 " in %zu), "
+      "%s scan without hooks %6.2f GB/s\n",
+      nhooked, table_ns, linear_ns, hits, linear_hits, nlinear, pc_event_scan_name(), scan_gbps);
+}
+
+int main() {
+  bench(10);
+  bench(1000);
+  bench(100 * 1000);
+  return 0;
+}
@@ -0,0 +1,103 @@
+
+#include <string>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <unistd.h>
+#include <inttypes.h>
+#include "../lib/trace_codec.h"
+
+using namespace std::chrono;
+
+#define READ_CHUNK_BYTES (1 << 20)
+
+static std::vector<uint8_t> load_trace(const char* path) {
+  std::vector<uint8_t> data;
+  trace_decoder_t* dec = open_trace_decoder(path);
+  if (dec == nullptr) {
+    printf("failed to open %s\n", path);
+    exit(1);
+  }
+  std::vector<uint8_t> chunk(READ_CHUNK_BYTES);
+  int n;
+  while ((n = dec->read(chunk.data(), chunk.size())) > 0)
+    data.insert(data.end(), chunk.begin(), chunk.begin() + n);
+  delete dec;
+  return data;
+}
+
+static std::vector<uint8_t> gen_trace(size_t nlines) {
+  std::mt19937_64 rng(0);
+  std::string text;
+  char line[256];
+  uint64_t time = 1000000;
+  uint64_t pc = 0xffffffff80000000ULL;
+  for (size_t i = 0; i < nlines; i++) {
+    time += 1 + rng() % 3;
+    pc += 2 + 2 * (rng() & 1);
+    bool has_w = rng() & 1;
+    snprintf(line, sizeof(line), "0 %" PRIu64 " %" PRIx64 " 1 0 0 %d 0 %" PRIx64 "\n",
+        time, pc, has_w, has_w ? (rng() & 0xffff) : 0);
+    text += line;
+  }
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static void bench(trace_codec_t codec, const std::vector<uint8_t>& data, int iters) {
+  std::string path = "/tmp/bench_trace_codec." + std::to_string(getpid()) +
+                     trace_codec_suffix(codec);
+
+  auto start = high_resolution_clock::now();
+  if (!write_trace_file(path, data.data(), data.size())) {
+    printf("failed to write %s\n", path.c_str());
+    exit(1);
+  }
+  auto end = high_resolution_clock::now();
+  double enc_secs = duration_cast<nanoseconds>(end - start).count() / 1e9;
+
+  FILE* fp = fopen(path.c_str(), "rb");
+  fseek(fp, 0, SEEK_END);
+  double file_bytes = (double)ftell(fp);
+  fclose(fp);
+
+  std::vector<uint8_t> chunk(READ_CHUNK_BYTES);
+  double dec_secs = 0.0;
+  for (int i = 0; i < iters; i++) {
+    size_t total = 0;
+    start = high_resolution_clock::now();
+    trace_decoder_t* dec = open_trace_decoder(path);
+    int n;
+    while ((n = dec->read(chunk.data(), chunk.size())) > 0)
+      total += (size_t)n;
+    delete dec;
+    end = high_resolution_clock::now();
+    dec_secs += duration_cast<nanoseconds>(end - start).count() / 1e9;
+    if (total != data.size()) {
+      printf("%s: decoded %zu bytes, expected %zu\n",
+          trace_codec_name(codec), total, data.size());
+      exit(1);
+    }
+  }
+  unlink(path.c_str());
+
+  printf("%-5s ratio %6.2f encode %8.1f MB/s decode %8.1f MB/s\n",
+      trace_codec_name(codec),
+      data.size() / file_bytes,
+      data.size() / enc_secs / 1e6,
+      data.size() * iters / dec_secs / 1e6);
+}
+
+int main(int argc, char** argv) {
+  // usage: ./bench_trace_codec [path to COSPIKE-TRACE-*]
+  std::vector<uint8_t> data = (argc > 1) ? load_trace(argv[1]) : gen_trace(1000 * 1000);
+  printf("%zu uncompressed bytes\n", data.size());
+
+  for (int c = 0; c < TRACE_CODEC_CNT; c++) {
+    trace_codec_t codec = (trace_codec_t)c;
+    if (trace_codec_available(codec))
+      bench(codec, data, 5);
+    else
+      printf("%-5s not built in\n", trace_codec_name(codec));
+  }
+  return 0;
+}
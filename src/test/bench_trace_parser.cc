@@ -0,0 +1,81 @@
+
+#include <string>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <zlib.h>
+#include <inttypes.h>
+#include "../lib/trace_reader.h"
+#include "../lib/trace_parser.h"
+
+using namespace std::chrono;
+
+static std::string load_trace(const char* path) {
+  std::string text;
+  gzFile fp = gzopen(path, "r");
+  if (fp == NULL) {
+    printf("failed to open %s\n", path);
+    exit(1);
+  }
+  char chunk[1 << 16];
+  int n;
+  while ((n = gzread(fp, chunk, sizeof(chunk))) > 0)
+    text.append(chunk, n);
+  gzclose(fp);
+  return text;
+}
+
+static std::string gen_trace(size_t nlines) {
+  std::mt19937_64 rng(0);
+  std::string text;
+  char line[256];
+  uint64_t time = 1000000;
+  uint64_t pc = 0xffffffff80000000ULL;
+  for (size_t i = 0; i < nlines; i++) {
+    time += 1 + rng() % 3;
+    pc += 2 + 2 * (rng() & 1);
+    snprintf(line, sizeof(line), "0 %" PRIu64 " %" PRIx64 " 1 0 0 %d 0 %" PRIx64 "\n",
+        time, pc, (int)(rng() & 1), rng());
+    text += line;
+  }
+  return text;
+}
+
+static size_t count_lines(const std::string& text) {
+  size_t n = 0;
+  for (char c : text)
+    if (c == '\n') n++;
+  return n;
+}
+
+static void bench(cospike_parser_t parser, const std::string& text, size_t nlines, int iters) {
+  trace_buffer_t* tbuf = new trace_buffer_t(nlines + 1);
+  double secs = 0.0;
+  for (int i = 0; i < iters; i++) {
+    auto start = high_resolution_clock::now();
+    parser((const uint8_t*)text.data(), text.size(), tbuf);
+    auto end = high_resolution_clock::now();
+    secs += duration_cast<nanoseconds>(end - start).count() / 1e9;
+    tbuf->clear();
+  }
+  double gb = (double)text.size() * iters / 1e9;
+  printf("%-8s %8.3f GB/s %8.2f Msteps/s\n",
+      cospike_parser_name(parser), gb / secs, (double)nlines * iters / secs / 1e6);
+  delete tbuf;
+}
+
+int main(int argc, char** argv) {
+  // usage: ./bench_trace_parser [path to COSPIKE-TRACE-*.gz]
+  std::string text = (argc > 1) ? load_trace(argv[1]) : gen_trace(1000 * 1000);
+  size_t nlines = count_lines(text);
+  printf("%zu bytes, %zu lines\n", text.size(), nlines);
+
+  bench(parse_cospike_scalar, text, nlines, 10);
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) bench(parse_cospike_sse42, text, nlines, 10);
+  if (__builtin_cpu_supports("avx2"))   bench(parse_cospike_avx2,  text, nlines, 10);
+#endif
+  return 0;
+}
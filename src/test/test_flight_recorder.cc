@@ -0,0 +1,67 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../lib/flight_recorder.h"
+
+#define NRECORDS 10000
+
+int main() {
+  flight_recorder_t rec(1000);
+  assert(rec.capacity() == 1024);
+  assert(rec.size() == 0);
+
+  // Fewer records than slots come back as they were written
+  for (uint64_t i = 0; i < 10; i++)
+    rec.record(FLIGHT_RTL_STEP, 1, i, i * 3, 0x80000000 + 4 * i, i, 0x80000000 + 4 * i, 0,
+               FLIGHT_VAL | FLIGHT_HAS_W);
+  std::vector<flight_record_t> snap;
+  rec.snapshot(snap);
+  assert(snap.size() == 10);
+  for (uint64_t i = 0; i < 10; i++) {
+    assert(snap[i].seq == i && snap[i].a == i * 3);
+    assert(snap[i].kind == FLIGHT_RTL_STEP && snap[i].hartid == 1);
+    assert(snap[i].flags == (FLIGHT_VAL | FLIGHT_HAS_W));
+  }
+
+  // Once wrapped, only the last capacity() records are kept, oldest first
+  for (uint64_t i = 10; i < NRECORDS; i++)
+    rec.record((uint8_t)(i % 5), (uint8_t)(i % 4), i, i * 3, i + 1, i + 2, i + 3, (uint32_t)i);
+  assert(rec.recorded() == NRECORDS);
+  assert(rec.size() == rec.capacity());
+  rec.snapshot(snap);
+  for (size_t i = 0; i < snap.size(); i++) {
+    uint64_t seq = NRECORDS - rec.capacity() + i;
+    assert(snap[i].seq == seq && snap[i].a == seq * 3 && snap[i].d == seq + 3);
+    assert(snap[i].kind == seq % 5 && snap[i].aux == (uint32_t)seq);
+  }
+
+  // Dumps read back as the same records
+  std::string path = "test-flight-recorder-" + std::to_string(getpid()) + ".bin";
+  assert(rec.dump(path));
+  std::vector<flight_record_t> loaded;
+  uint64_t recorded = 0;
+  assert(read_flight_dump(path, loaded, recorded));
+  assert(recorded == NRECORDS);
+  assert(loaded.size() == snap.size());
+  for (size_t i = 0; i < loaded.size(); i++)
+    assert(memcmp(&loaded[i], &snap[i], sizeof(flight_record_t)) == 0);
+  for (size_t i = loaded.size() - 5; i < loaded.size(); i++)
+    print_flight_record(stdout, loaded[i]);
+
+  // Truncated dumps are rejected
+  FILE* fp = fopen(path.c_str(), "r+b");
+  assert(fp != NULL);
+  assert(ftruncate(fileno(fp), sizeof(flight_dump_header_t) + 10) == 0);
+  fclose(fp);
+  assert(!read_flight_dump(path, loaded, recorded));
+  assert(loaded.empty());
+  remove(path.c_str());
+  assert(!read_flight_dump(path, loaded, recorded));
+
+  std::cout << "Test passed\n";
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <map>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <assert.h>
+#include "../profiler/pc_event_table.h"
+
+using namespace profiler;
+
+int main() {
+  std::mt19937_64 rng(3);
+  pc_event_table_t table;
+  std::map<addr_t, pc_event_t> ref;
+
+  // Kernel text like pcs, some registered both as start and exit
+  for (int i = 0; i < 20000; i++) {
+    addr_t pc = 0xffffffff80000000ULL + 2 * (rng() % (8 << 20));
+    function_t* f = (function_t*)(uintptr_t)(16 * (1 + rng() % 100));
+    pc_event_t& e = table.insert(pc);
+    pc_event_t& r = ref[pc];
+    if (rng() % 2) {
+      e.is_start = r.is_start = true;
+      e.func = r.func = f;
+    } else {
+      e.is_exit = r.is_exit = true;
+    }
+  }
+  assert(table.size() == ref.size());
+
+  for (auto& x : ref) {
+    const pc_event_t* e = table.lookup(x.first);
+    assert(e != nullptr);
+    assert(e->is_start == x.second.is_start);
+    assert(e->is_exit == x.second.is_exit);
+    assert(!e->is_start || e->func == x.second.func);
+  }
+
+  uint64_t misses = 0;
+  for (int i = 0; i < 1000000; i++) {
+    addr_t pc = 0xffffffff80000000ULL + 2 * (rng() % (16 << 20));
+    if (ref.find(pc) == ref.end()) {
+      assert(table.lookup(pc) == nullptr);
+      misses++;
+    }
+  }
+  printf("%zu pcs, %" PRIu64 " misses checked\n", table.size(), misses);
+
+  // The scan stops at the first start and reports the exits before it,
+  // whatever the alignment of the start and the exits in the chunk
+  for (int t = 0; t < 2000; t++) {
+    std::vector<trace_entry_t> chunk(1 + rng() % 300);
+    for (auto& x : chunk)
+      x = { 0xffffffff80000000ULL + 2 * (rng() % (16 << 20)), 0, 0 };
+    for (int k = rng() % 4; k > 0; k--) {
+      auto it = ref.begin();
+      std::advance(it, rng() % ref.size());
+      chunk[rng() % chunk.size()].pc = it->first;
+    }
+
+    size_t start = chunk.size();
+    std::vector<size_t> exits;
+    for (size_t i = 0; i < chunk.size() && start == chunk.size(); i++) {
+      auto it = ref.find(chunk[i].pc);
+      if (it == ref.end())
+        continue;
+      if (it->second.is_start)
+        start = i;
+      else
+        exits.push_back(i);
+    }
+
+    std::vector<size_t> scan_exits;
+    assert(table.scan(chunk.data(), chunk.size(), scan_exits) == start);
+    assert(scan_exits == exits);
+  }
+  printf("%s scan passed\n", pc_event_scan_name());
+
+  std::cout << "Test passed\n";
+  return 0;
+}
@@ -0,0 +1,45 @@
+#include <string>
+#include <thread>
+#include <iostream>
+#include <assert.h>
+#include <inttypes.h>
+#include "../lib/spsc_ring.h"
+
+#define NITEMS (1000 * 1000)
+
+struct item_t {
+  uint64_t seq;
+  uint64_t check;
+};
+
+int main() {
+  // A small ring so that both sides block on it many times
+  spsc_ring_t<item_t> ring(100);
+  assert(ring.capacity() == 128);
+
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < NITEMS; i++)
+      ring.push({ i, i * 0x9E3779B97F4A7C15ULL });
+  });
+  for (uint64_t i = 0; i < NITEMS; i++) {
+    item_t x = ring.pop();
+    assert(x.seq == i);
+    assert(x.check == i * 0x9E3779B97F4A7C15ULL);
+  }
+  producer.join();
+  printf("%d items, stalls (ms) producer: %f consumer: %f\n", NITEMS,
+      ring.producer_stall_ns() / 1e6, ring.consumer_stall_ns() / 1e6);
+
+  // Non trivial payloads are moved through
+  spsc_ring_t<std::string> strs(4);
+  std::thread sender([&] {
+    for (int i = 0; i < 1000; i++)
+      strs.push(std::string(i % 64, 'a' + i % 26));
+  });
+  for (int i = 0; i < 1000; i++)
+    assert(strs.pop() == std::string(i % 64, 'a' + i % 26));
+  sender.join();
+
+  std::cout << "Test passed\n";
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iostream>
+#include <assert.h>
+#include <inttypes.h>
+#include "../lib/tick_sched.h"
+
+#define NDEVS  16
+#define NSTEPS 200000
+
+struct tick_t {
+  uint64_t step;
+  uint32_t id;
+  bool operator==(const tick_t& o) const { return step == o.step && id == o.id; }
+};
+
+// Fires the events due at every step in [from, to), rescheduling each a
+// period later, the way sim_lib_t ticks its devices
+static void run(tick_sched_t& sched, const std::vector<uint64_t>& periods,
+                uint64_t from, uint64_t to, std::vector<tick_t>& ticks) {
+  for (uint64_t step = from; step < to; step++) {
+    if (step < sched.next_due())
+      continue;
+    tick_event_t ev;
+    while (sched.pop_due(step, ev)) {
+      ticks.push_back({ step, ev.id });
+      sched.schedule(ev.id, ev.due + periods[ev.id]);
+    }
+  }
+}
+
+int main() {
+  std::mt19937_64 rng(18);
+  std::vector<uint64_t> periods(NDEVS);
+  std::vector<uint64_t> phases(NDEVS);
+  tick_sched_t sched;
+  for (uint32_t i = 0; i < NDEVS; i++) {
+    periods[i] = 1 + rng() % 2000;
+    phases[i] = rng() % periods[i];
+    sched.schedule(i, phases[i]);
+  }
+  assert(sched.next_due() != TICK_SCHED_NEVER);
+
+  // Same ticks as testing step % period at every step, in id order
+  std::vector<tick_t> ref;
+  for (uint64_t step = 0; step < NSTEPS; step++)
+    for (uint32_t i = 0; i < NDEVS; i++)
+      if (step >= phases[i] && (step - phases[i]) % periods[i] == 0)
+        ref.push_back({ step, i });
+
+  std::vector<tick_t> ticks;
+  run(sched, periods, 0, NSTEPS, ticks);
+  assert(ticks == ref);
+  printf("%zu ticks of %d devices\n", ticks.size(), NDEVS);
+
+  // Restoring the pending events in any order continues with the same ticks
+  tick_sched_t a = sched;
+  tick_sched_t b;
+  std::vector<tick_event_t> pending = sched.pending();
+  std::shuffle(pending.begin(), pending.end(), rng);
+  for (auto& ev : pending)
+    b.schedule(ev.id, ev.due);
+
+  std::vector<tick_t> ta, tb;
+  run(a, periods, NSTEPS, 2 * NSTEPS, ta);
+  run(b, periods, NSTEPS, 2 * NSTEPS, tb);
+  assert(!ta.empty() && ta == tb);
+
+  tick_sched_t empty;
+  tick_event_t ev;
+  assert(empty.next_due() == TICK_SCHED_NEVER);
+  assert(!empty.pop_due(TICK_SCHED_NEVER, ev));
+
+  std::cout << "Test passed\n";
+  return 0;
+}
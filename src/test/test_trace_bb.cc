@@ -0,0 +1,146 @@
+#include <string>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../lib/trace_bb.h"
+
+#define NINSNS      4096
+#define NSTEPS      200000
+#define CODE_BASE   0x80000000ULL
+#define USER_ASID   7
+
+struct program_t {
+  std::vector<uint64_t> pcs;
+  std::vector<int> lens;
+};
+
+// A text section of mixed 16-bit and 32-bit instructions, written out the
+// way objdump -d prints it
+static program_t write_program(const std::string& path, uint64_t base, std::mt19937_64& rng) {
+  program_t prog;
+  FILE* fp = fopen(path.c_str(), "w");
+  assert(fp != NULL);
+  fprintf(fp, "\n%016" PRIx64 " <func>:\n", base);
+  uint64_t pc = base;
+  for (int i = 0; i < NINSNS; i++) {
+    int len = (rng() % 3 == 0) ? 2 : 4;
+    prog.pcs.push_back(pc);
+    prog.lens.push_back(len);
+    if (len == 2)
+      fprintf(fp, "%" PRIx64 ":\t%04x                \tc.nop\n", pc, 0x0001);
+    else
+      fprintf(fp, "%" PRIx64 ":\t%08x          \taddi\tzero,zero,0 # %" PRIx64 " <func>\n", pc, 0x00000013, base);
+    pc += len;
+  }
+  fclose(fp);
+  return prog;
+}
+
+int main() {
+  std::mt19937_64 rng(25);
+  std::string kpath = "test-trace-bb-kernel-" + std::to_string(getpid()) + ".dump";
+  std::string upath = "test-trace-bb-user-" + std::to_string(getpid()) + ".dump";
+  program_t kernel = write_program(kpath, CODE_BASE, rng);
+  program_t user = write_program(upath, 0x10000, rng);
+
+  static_code_t code;
+  bool kernel_added = code.add_objdump(kpath);
+  bool user_added = code.add_objdump(upath, USER_ASID);
+  assert(kernel_added && user_added);
+  assert(code.size() == 2 * NINSNS);
+  assert(code.insn_length(kernel.pcs[5], 3) == kernel.lens[5]);
+  assert(code.insn_length(user.pcs[5], USER_ASID) == user.lens[5]);
+  assert(code.insn_length(user.pcs[5], 3) == 0);
+  remove(kpath.c_str());
+  remove(upath.c_str());
+
+  // Straight line code with taken branches, asid switches, traps (the
+  // instruction is not retired, the next one has the same cycle) and
+  // re-executed instructions
+  trace_t full;
+  bb_trace_t bb;
+  uint64_t asid = 0;
+  uint64_t cycle = 1000;
+  size_t idx = 0;
+  uint64_t cont_pc = 0;
+  for (int i = 0; i < NSTEPS; i++) {
+    const program_t& prog = (asid == USER_ASID) ? user : kernel;
+    uint64_t pc = prog.pcs[idx];
+    full.push_back({ pc, asid, cycle });
+    bb_trace_add(bb, pc, asid, cycle, cont_pc);
+    cont_pc = pc + prog.lens[idx];
+
+    uint64_t r = rng() % 1000;
+    if (r < 2) {
+      asid = (asid == USER_ASID) ? 0 : USER_ASID;
+      idx = rng() % NINSNS;
+      cycle++;
+    } else if (r < 4) {
+      idx = rng() % NINSNS;       // trap
+    } else if (r < 5) {
+      // re-executed
+    } else if (r < 120 || idx + 1 == NINSNS) {
+      idx = rng() % NINSNS;       // taken branch
+      cycle++;
+    } else {
+      idx++;
+      cycle++;
+    }
+  }
+  printf("%zu instructions in %zu runs (%.1fx smaller)\n",
+      full.size(), bb.size(), (double)full.size() / bb.size());
+  assert(bb.size() < full.size() / 4);
+
+  trace_t expanded;
+  bool expanded_ok = bb_trace_expand(bb, code, expanded);
+  assert(expanded_ok);
+  assert(expanded.size() == full.size());
+  for (size_t i = 0; i < full.size(); i++) {
+    assert(expanded[i].pc == full[i].pc);
+    assert(expanded[i].asid == full[i].asid);
+    assert(expanded[i].cycle == full[i].cycle);
+  }
+
+  // Files written in pieces read back as one trace
+  std::string path = "test-trace-bb-" + std::to_string(getpid()) + ".bin";
+  {
+    bb_trace_writer_t writer(path);
+    bb_trace_t first(bb.begin(), bb.begin() + bb.size() / 3);
+    bb_trace_t rest(bb.begin() + bb.size() / 3, bb.end());
+    bool appended = writer.append(first);
+    appended &= writer.append(rest);
+    assert(appended);
+    assert(writer.entries() == bb.size());
+    bool closed = writer.close();
+    assert(closed);
+  }
+  bb_trace_t loaded;
+  bool read_ok = read_bb_trace(path, loaded);
+  assert(read_ok);
+  assert(loaded.size() == bb.size());
+  assert(memcmp(loaded.data(), bb.data(), bb.size() * sizeof(bb_trace_entry_t)) == 0);
+  remove(path.c_str());
+  read_ok = read_bb_trace(path, loaded);
+  assert(!read_ok);
+
+  // A pc that is not in the static code stops the expansion
+  bb_trace_t unknown = { { CODE_BASE + 1, 0, 0, 0, 2 } };
+  expanded.clear();
+  expanded_ok = bb_trace_expand(unknown, code, expanded);
+  assert(!expanded_ok);
+
+  // Instruction lengths from a real objdump
+  static_code_t dump;
+  bool dump_added = dump.add_objdump("../test/test.dump");
+  assert(dump_added);
+  assert(dump.insn_length(0xffffffff8019ce42ULL, 0) == 2);
+  assert(dump.insn_length(0xffffffff8019ce5cULL, 0) == 4);
+  assert(dump.insn_length(0xffffffff8019ce43ULL, 0) == 0);
+
+  std::cout << "Test passed\n";
+  return 0;
+}
@@ -0,0 +1,192 @@
+
+#include <string>
+#include <random>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <assert.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "../lib/trace_reader.h"
+#include "../lib/trace_index.h"
+#include "../lib/trace_packed.h"
+
+#define NFILES          3
+#define STEPS_PER_FILE  20000
+#define STEPS_PER_BLOCK 1500
+
+static rtl_step_t gen_step(std::mt19937_64& rng, uint64_t idx) {
+  rtl_step_t s;
+  s.time   = idx * 3 + 1;
+  s.pc     = 0x80000000ULL + 4 * (rng() % 4096);
+  s.val    = rng() & 1;
+  s.except = false;
+  s.intrpt = false;
+  s.has_w  = rng() & 1;
+  s.cause  = 0;
+  s.wdata  = s.has_w ? rng() : 0;
+  return s;
+}
+
+static std::string text_line(const rtl_step_t& s) {
+  char line[256];
+  snprintf(line, sizeof(line), "0 %" PRIu64 " %" PRIx64 " %d %d %d %d %d %" PRIx64 "\n",
+      s.time, s.pc, s.val, s.except, s.intrpt, s.has_w, s.cause, s.wdata);
+  return line;
+}
+
+// File 1 is written without an index to check that blocked and plain files
+// can be mixed
+static void write_traces(const std::string& dir, bool packed, std::vector<rtl_step_t>& steps) {
+  std::mt19937_64 rng(1);
+  for (int f = 0; f < NFILES; f++) {
+    std::string path = dir + "/COSPIKE-TRACE-0-" + std::to_string(f) + (packed ? ".bin.gz" : ".gz");
+    blocked_trace_writer_t writer(path);
+    std::vector<uint8_t> whole;
+    std::vector<uint8_t> block;
+    uint64_t nsteps = 0;
+    packed_trace_state_t st = {};
+    packed_trace_header_t hdr;
+    packed_trace_header(hdr, 0);
+
+    for (int i = 0; i <= STEPS_PER_FILE; i++) {
+      if (i == STEPS_PER_FILE || (nsteps == STEPS_PER_BLOCK)) {
+        assert(writer.add_block(block.data(), block.size(), nsteps));
+        whole.insert(whole.end(), block.begin(), block.end());
+        block.clear();
+        nsteps = 0;
+      }
+      if (i == STEPS_PER_FILE)
+        break;
+
+      if (packed && nsteps == 0) {
+        block.insert(block.end(), (uint8_t*)&hdr, (uint8_t*)&hdr + sizeof(hdr));
+        st = {};
+      }
+      rtl_step_t s = gen_step(rng, steps.size());
+      steps.push_back(s);
+      if (packed) {
+        packed_trace_encode(s, st, block);
+      } else {
+        std::string line = text_line(s);
+        block.insert(block.end(), line.begin(), line.end());
+      }
+      nsteps++;
+    }
+    assert(writer.close());
+
+    if (f == 1) {
+      std::filesystem::remove(path + TRACE_INDEX_SUFFIX);
+      assert(write_trace_file(path, whole.data(), whole.size()));
+    }
+  }
+}
+
+static void check_traces(const std::string& dir, const std::vector<rtl_step_t>& steps) {
+  trace_reader_t* reader = new trace_reader_t(0, 4, STEPS_PER_FILE + 1, 1, dir);
+  reader->start();
+
+  // Half of the steps are bubbles, which the reader drops
+  size_t kept = 0;
+  for (auto& e : steps)
+    kept += e.val;
+
+  size_t i = 0;
+  uint64_t units = 0;
+  while (kept > 0) {
+    trace_buffer_t* buf = reader->cur_buffer();
+    bool first = true;
+    while (!buf->empty()) {
+      rtl_step_t& s = buf->pop_front();
+      uint32_t idle = 0;
+      while (!steps[i].val) {
+        idle++;
+        i++;
+      }
+      rtl_step_t e = steps[i];
+      // Bubbles at the end of the previous unit are not counted
+      bool idle_ok = first ? (s.idle <= idle) : (s.idle == idle);
+      if (s.time != e.time || s.pc != e.pc || s.val != e.val || !idle_ok ||
+          s.has_w != e.has_w || (s.has_w && s.wdata != e.wdata)) {
+        printf("mismatch at step %zu\n", i);
+        e.print();
+        s.print();
+        assert(false);
+      }
+      i++;
+      kept--;
+      first = false;
+    }
+    reader->pop_buffer();
+    units++;
+  }
+  // Two blocked files plus one plain file
+  uint64_t blocks_per_file = (STEPS_PER_FILE + STEPS_PER_BLOCK - 1) / STEPS_PER_BLOCK;
+  assert(units == 2 * blocks_per_file + 1);
+  // The pool never outgrows the thread limit and always keeps a unit in flight
+  assert(reader->active_threads() >= 1 && reader->max_active_threads() <= 4);
+  assert(reader->depth() >= 2 && reader->depth() <= reader->max_depth());
+  delete reader;
+}
+
+// A file cut off inside a compressed stream must be a read error and not a
+// short file, the whole file must still read back
+static void check_truncated(const std::string& dir) {
+  std::vector<uint8_t> raw;
+  std::mt19937_64 rng(2);
+  for (int i = 0; i < STEPS_PER_BLOCK; i++) {
+    std::string line = text_line(gen_step(rng, i));
+    raw.insert(raw.end(), line.begin(), line.end());
+  }
+
+  for (int c = TRACE_CODEC_GZ; c < TRACE_CODEC_CNT; c++) {
+    trace_codec_t codec = (trace_codec_t)c;
+    if (!trace_codec_available(codec))
+      continue;
+
+    std::vector<uint8_t> comp;
+    assert(trace_compress(codec, raw.data(), raw.size(), comp));
+    for (size_t keep : { comp.size(), comp.size() - 1, comp.size() / 2 }) {
+      std::string path = dir + "/truncated" + trace_codec_suffix(codec);
+      FILE* fp = fopen(path.c_str(), "wb");
+      assert(fwrite(comp.data(), 1, keep, fp) == keep);
+      fclose(fp);
+
+      trace_decoder_t* dec = open_trace_decoder(path);
+      assert(dec != nullptr);
+      std::vector<uint8_t> out(raw.size() + 1);
+      size_t total = 0;
+      int n;
+      while ((n = dec->read(out.data() + total, out.size() - total)) > 0)
+        total += n;
+      if (keep == comp.size())
+        assert(n == 0 && total == raw.size());
+      else
+        assert(n < 0 && !dec->error().empty());
+      delete dec;
+    }
+    printf("truncated %s streams are errors\n", trace_codec_name(codec));
+  }
+}
+
+int main() {
+  for (bool packed : { false, true }) {
+    std::string dir = std::filesystem::temp_directory_path().string() +
+                      "/test_trace_blocks." + std::to_string(getpid());
+    std::filesystem::create_directories(dir);
+
+    std::vector<rtl_step_t> steps;
+    write_traces(dir, packed, steps);
+    check_traces(dir, steps);
+
+    std::filesystem::remove_all(dir);
+    printf("%s blocked traces passed\n", packed ? "packed" : "text");
+  }
+
+  std::string dir = std::filesystem::temp_directory_path().string() +
+                    "/test_trace_blocks." + std::to_string(getpid());
+  std::filesystem::create_directories(dir);
+  check_truncated(dir);
+  std::filesystem::remove_all(dir);
+  return 0;
+}
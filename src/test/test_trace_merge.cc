@@ -0,0 +1,131 @@
+#include <string>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <filesystem>
+#include <assert.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <inttypes.h>
+#include "../lib/trace_merge.h"
+
+#define NHARTS         3
+#define STEPS_PER_FILE 4000
+
+// Tags every third pc as an exit and every third as the start of one of two
+// functions
+class test_classifier_t : public trace_classifier_t {
+public:
+  uint8_t classify(uint64_t pc) const override {
+    switch ((pc >> 2) % 3) {
+      case 0:  return TRACE_EVENT_NONE;
+      case 1:  return TRACE_EVENT_EXIT;
+      default: return TRACE_EVENT_FUNC + (pc >> 4) % 2;
+    }
+  }
+};
+
+struct hart_step_t {
+  int hartid;
+  rtl_step_t step;
+};
+
+// Each hart gets a different number of files. Times advance by 0 to 3 per
+// step, so steps of different harts (and of the same hart) share times.
+static void write_traces(const std::string& dir, std::vector<hart_step_t>& steps) {
+  std::mt19937_64 rng(7);
+  for (int h = 0; h < NHARTS; h++) {
+    uint64_t time = 0;
+    int nfiles = NHARTS - h;
+    for (int f = 0; f < nfiles; f++) {
+      std::string path = dir + "/COSPIKE-TRACE-" + std::to_string(h) + "-" + std::to_string(f) + ".gz";
+      gzFile fp = gzopen(path.c_str(), "wb");
+      for (int i = 0; i < STEPS_PER_FILE; i++) {
+        time += rng() % 4;
+        rtl_step_t s(true, time, 0x80000000ULL + 4 * (rng() % 4096), 0, false, false, 0, false, 0, 0);
+        gzprintf(fp, "0 %" PRIu64 " %" PRIx64 " 1 0 0 0 0 0\n", s.time, s.pc);
+        steps.push_back({ h, s });
+      }
+      gzclose(fp);
+    }
+    FILE* done = fopen((dir + "/COSPIKE-TRACE-" + std::to_string(h) + "-DONE").c_str(), "w");
+    fclose(done);
+  }
+}
+
+int main() {
+  std::string dir = std::filesystem::temp_directory_path().string() +
+                    "/test_trace_merge." + std::to_string(getpid());
+  std::filesystem::create_directories(dir);
+
+  std::vector<hart_step_t> steps;
+  write_traces(dir, steps);
+
+  // Reference order: by time, then by hart, keeping the order within a hart
+  std::stable_sort(steps.begin(), steps.end(), [](const hart_step_t& a, const hart_step_t& b) {
+      if (a.step.time != b.step.time)
+        return a.step.time < b.step.time;
+      return a.hartid < b.hartid;
+      });
+
+  {
+    merged_trace_reader_t reader({ 0, 1, 2 }, 4, STEPS_PER_FILE + 1, 1, dir);
+    reader.start();
+    size_t i = 0;
+    trace_run_t run;
+    while (reader.next(run)) {
+      assert(run.size() > 0);
+      for (rtl_step_t& s : run) {
+        assert(i < steps.size());
+        if (steps[i].hartid != run.hartid || steps[i].step.time != s.time || steps[i].step.pc != s.pc) {
+          printf("step %zu: expected hart %d, got hart %d\n", i, steps[i].hartid, run.hartid);
+          s.print();
+          assert(false);
+        }
+        i++;
+      }
+    }
+    assert(i == steps.size());
+    assert(reader.active_harts() == 0);
+    printf("merged %zu steps of %d harts\n", i, NHARTS);
+  }
+
+  {
+    // A single hart hands out whole buffers
+    merged_trace_reader_t reader({ 1 }, 2, STEPS_PER_FILE + 1, 1, dir);
+    reader.start();
+    int runs = 0;
+    trace_run_t run;
+    while (reader.next(run)) {
+      assert(run.hartid == 1 && run.size() == STEPS_PER_FILE);
+      runs++;
+    }
+    assert(runs == NHARTS - 1);
+    printf("single hart passed\n");
+  }
+
+  {
+    // Every step but the last of a unit is tagged with the event of the next pc
+    test_classifier_t classifier;
+    merged_trace_reader_t reader({ 0 }, 2, STEPS_PER_FILE + 1, 1, dir);
+    reader.set_classifier(&classifier);
+    reader.start();
+    uint64_t tagged = 0;
+    trace_run_t run;
+    while (reader.next(run)) {
+      rtl_step_t* last = run.end() - 1;
+      for (rtl_step_t* s = run.begin(); s != last; s++) {
+        assert(s->event == classifier.classify(s[1].pc));
+        tagged++;
+      }
+      assert(last->event == TRACE_EVENT_UNKNOWN);
+    }
+    assert(tagged == NHARTS * (STEPS_PER_FILE - 1));
+    printf("classification passed\n");
+  }
+
+  std::filesystem::remove_all(dir);
+  std::cout << "Test passed\n";
+  return 0;
+}
@@ -0,0 +1,86 @@
+
+#include <random>
+#include <vector>
+#include <iostream>
+#include <assert.h>
+#include "../lib/trace_reader.h"
+#include "../lib/trace_packed.h"
+
+static bool same_step(const rtl_step_t& x, const rtl_step_t& y) {
+  return x.time == y.time && x.pc == y.pc && x.val == y.val &&
+         x.except == y.except && x.intrpt == y.intrpt && x.has_w == y.has_w &&
+         x.cause == y.cause && x.wdata == y.wdata;
+}
+
+int main() {
+  std::mt19937_64 rng(0);
+  std::vector<rtl_step_t> steps;
+  uint64_t time = 0;
+  uint64_t pc = 0xffffffff80000000ULL;
+  for (int i = 0; i < 100000; i++) {
+    rtl_step_t s;
+    time += rng() % 5;
+    // Mostly sequential code with the occasional far jump in either direction
+    pc = (i % 50 == 0) ? rng() : pc + 2 + 2 * (rng() & 1);
+    s.time   = (i % 1000 == 999) ? rng() : time;
+    s.pc     = pc;
+    s.val    = rng() & 1;
+    s.except = (rng() % 100) == 0;
+    s.intrpt = (rng() % 100) == 0;
+    s.has_w  = rng() & 1;
+    s.cause  = (int)(rng() % 64);
+    s.wdata  = s.has_w ? rng() : 0;
+    steps.push_back(s);
+  }
+
+  std::vector<uint8_t> packed;
+  packed_trace_state_t enc = {};
+  for (auto& s : steps)
+    packed_trace_encode(s, enc, packed);
+
+  // Feed the decoder arbitrarily sized pieces so that records get split
+  trace_buffer_t* tbuf = new trace_buffer_t(steps.size() + 1);
+  packed_trace_state_t dec = {};
+  size_t done = 0;
+  size_t avail = 0;
+  while (avail < packed.size()) {
+    avail = std::min(packed.size(), avail + 1 + (size_t)(rng() % 200));
+    done += packed_trace_decode(packed.data() + done, avail - done, dec, tbuf);
+  }
+  assert(done == packed.size());
+
+  size_t i = 0;
+  while (!tbuf->empty()) {
+    rtl_step_t& s = tbuf->pop_front();
+    if (!same_step(s, steps[i])) {
+      printf("mismatch at step %zu\n", i);
+      steps[i].print();
+      s.print();
+      assert(false);
+    }
+    i++;
+  }
+  assert(i == steps.size());
+  delete tbuf;
+
+  // Dropping bubbles must not disturb the delta bases of the following records
+  tbuf = new trace_buffer_t(steps.size() + 1, true);
+  dec = {};
+  assert(packed_trace_decode(packed.data(), packed.size(), dec, tbuf) == packed.size());
+  uint32_t idle = 0;
+  for (auto& e : steps) {
+    if (!(e.val || e.except || e.intrpt)) {
+      idle++;
+      continue;
+    }
+    rtl_step_t& s = tbuf->pop_front();
+    assert(same_step(s, e) && s.idle == idle);
+    idle = 0;
+  }
+  assert(tbuf->empty());
+  delete tbuf;
+
+  printf("%zu steps packed into %zu bytes (%.2f bytes/step)\n",
+      steps.size(), packed.size(), (double)packed.size() / steps.size());
+  return 0;
+}
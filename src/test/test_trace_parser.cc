@@ -0,0 +1,161 @@
+
+#include <string>
+#include <random>
+#include <iostream>
+#include <assert.h>
+#include <inttypes.h>
+#include "../lib/trace_reader.h"
+#include "../lib/trace_parser.h"
+
+static std::string gen_trace(size_t nlines, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::string text;
+  char line[256];
+  uint64_t time = 0;
+  for (size_t i = 0; i < nlines; i++) {
+    // Mix short and long fields so that every SWAR chunking path is hit
+    int shift = (int)(rng() % 64);
+    time += rng() % 7;
+    uint64_t t  = (i % 97 == 0) ? (rng() >> shift) : time;
+    uint64_t pc = rng() >> (rng() % 64);
+    uint64_t wd = rng() >> (rng() % 64);
+    int cause   = (int)(rng() % 16);
+    snprintf(line, sizeof(line), "0 %" PRIu64 " %" PRIx64 " %d %d %d %d %d %" PRIx64 "\n",
+        t, pc, (int)(rng() & 1), (int)(rng() & 1), (int)(rng() & 1), (int)(rng() & 1),
+        cause, wd);
+    text += line;
+  }
+  return text;
+}
+
+static void check_parser(cospike_parser_t parser, const std::string& text, size_t nlines) {
+  trace_buffer_t* expect = new trace_buffer_t(nlines + 1);
+  trace_buffer_t* actual = new trace_buffer_t(nlines + 1);
+
+  const uint8_t* bytes = (const uint8_t*)text.data();
+  size_t e = parse_cospike_scalar(bytes, text.size(), expect);
+  size_t a = parser(bytes, text.size(), actual);
+  assert(e == a);
+
+  size_t cnt = 0;
+  while (!expect->empty()) {
+    assert(!actual->empty());
+    rtl_step_t& x = expect->pop_front();
+    rtl_step_t& y = actual->pop_front();
+    if (x.time != y.time || x.pc != y.pc || x.val != y.val ||
+        x.except != y.except || x.intrpt != y.intrpt || x.has_w != y.has_w ||
+        x.cause != y.cause || x.wdata != y.wdata) {
+      printf("%s mismatch at line %zu\n", cospike_parser_name(parser), cnt);
+      x.print();
+      y.print();
+      assert(false);
+    }
+    cnt++;
+  }
+  assert(actual->empty());
+  assert(cnt == nlines);
+
+  delete expect;
+  delete actual;
+}
+
+// Bubbles are dropped and counted in the idle field of the next kept step,
+// also when a run of bubbles spans two parser calls
+static void check_filter(cospike_parser_t parser, const std::string& text, size_t nlines) {
+  trace_buffer_t* all = new trace_buffer_t(nlines + 1);
+  trace_buffer_t* kept = new trace_buffer_t(nlines + 1, true);
+
+  const uint8_t* bytes = (const uint8_t*)text.data();
+  parse_cospike_scalar(bytes, text.size(), all);
+  size_t half = parser(bytes, text.size() / 2, kept);
+  parser(bytes + half, text.size() - half, kept);
+
+  uint32_t idle = 0;
+  uint64_t bubbles = 0;
+  while (!all->empty()) {
+    rtl_step_t& x = all->pop_front();
+    if (!(x.val || x.except || x.intrpt)) {
+      idle++;
+      bubbles++;
+      continue;
+    }
+    assert(!kept->empty());
+    rtl_step_t& y = kept->pop_front();
+    if (x.time != y.time || x.pc != y.pc || y.idle != idle) {
+      printf("%s filter mismatch, idle %u\n", cospike_parser_name(parser), idle);
+      x.print();
+      y.print();
+      assert(false);
+    }
+    idle = 0;
+  }
+  assert(kept->empty());
+  assert(kept->bubbles() == bubbles && bubbles > 0);
+
+  delete all;
+  delete kept;
+}
+
+// A run of bubbles longer than the idle field holds is split by keeping a
+// bubble step, the kept steps still account for every bubble
+static void check_long_idle(cospike_parser_t parser) {
+  const size_t nbubbles = 3 * 65536 + 1234;
+  std::string text = "0 1 80000000 1 0 0 0 0 0\n";
+  for (size_t i = 0; i < nbubbles; i++)
+    text += "0 2 80000004 0 0 0 0 0 0\n";
+  text += "0 3 80000004 1 0 0 0 0 0\n";
+
+  trace_buffer_t* kept = new trace_buffer_t(nbubbles + 3, true);
+  const uint8_t* bytes = (const uint8_t*)text.data();
+  size_t half = parser(bytes, text.size() / 2, kept);
+  parser(bytes + half, text.size() - half, kept);
+
+  uint64_t total = 0;
+  size_t nkept = 0;
+  size_t kept_bubbles = 0;
+  while (!kept->empty()) {
+    rtl_step_t& y = kept->pop_front();
+    total += y.idle;
+    if (!y.val) {
+      assert(y.idle == UINT16_MAX);
+      kept_bubbles++;
+      total++;
+    }
+    nkept++;
+  }
+  assert(total == nbubbles);
+  assert(kept_bubbles == nbubbles / 65536);
+  assert(nkept == kept_bubbles + 2);
+  assert(kept->bubbles() == nbubbles - kept_bubbles);
+
+  delete kept;
+}
+
+int main() {
+  std::vector<cospike_parser_t> parsers = { parse_cospike_scalar };
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) parsers.push_back(parse_cospike_sse42);
+  if (__builtin_cpu_supports("avx2"))   parsers.push_back(parse_cospike_avx2);
+#endif
+
+  for (uint64_t seed = 0; seed < 8; seed++) {
+    size_t nlines = 1000 + seed * 17;
+    std::string text = gen_trace(nlines, seed);
+    for (auto p : parsers) {
+      check_parser(p, text, nlines);
+
+      // A trailing partial line must be left for the next chunk
+      std::string partial = text + "0 12 8000";
+      check_parser(p, partial, nlines);
+
+      check_filter(p, text, nlines);
+    }
+  }
+
+  for (auto p : parsers)
+    check_long_idle(p);
+
+  std::cout << "Selected parser: " << cospike_parser_name(cospike_parser()) << std::endl;
+  return 0;
+}
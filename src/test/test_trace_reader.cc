@@ -24,9 +24,6 @@ int main(int argc, char** argv) {
   uint64_t cur_step = 0;
   for (int i = 0; i < num_files; i++) {
     trace_buffer_t* buf = reader->cur_buffer();
-    while (!buf->can_consume()) {
-      ;
-    }
     while (!buf->empty()) {
       rtl_step_t& step = buf->pop_front();
       if (cur_step > step.time) {
@@ -36,11 +33,12 @@ int main(int argc, char** argv) {
       }
       cur_step = step.time;
     }
-    buf->done_consume();
     reader->pop_buffer();
   }
   auto end = high_resolution_clock::now();
   auto duration = duration_cast<seconds>(end - start);
   std::cout << "Test passed: " << duration.count() << " seconds\n";
+  std::cout << "Consumer stall: " << reader->consumer_stall_ns() / 1e9 << " seconds\n";
+  std::cout << "Producer stall: " << reader->producer_stall_ns() / 1e9 << " seconds\n";
   return 0;
 }
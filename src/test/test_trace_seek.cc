@@ -0,0 +1,130 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <assert.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "../lib/trace_reader.h"
+#include "../lib/trace_index.h"
+
+#define NFILES          4
+#define STEPS_PER_FILE  10000
+#define STEPS_PER_BLOCK 1000
+
+static uint64_t step_time(uint64_t idx) {
+  return 2 * idx + 1;
+}
+
+// Odd files are blocked, even files are plain gzip files
+static void write_traces(const std::string& dir) {
+  uint64_t idx = 0;
+  for (int f = 0; f < NFILES; f++) {
+    std::string path = dir + "/COSPIKE-TRACE-0-" + std::to_string(f) + ".gz";
+    std::vector<uint8_t> data;
+    blocked_trace_writer_t* writer = (f % 2 == 1) ? new blocked_trace_writer_t(path) : nullptr;
+    for (int i = 0; i < STEPS_PER_FILE; i++, idx++) {
+      char line[128];
+      int n = snprintf(line, sizeof(line), "0 %" PRIu64 " %" PRIx64 " 1 0 0 0 0 0\n",
+          step_time(idx), (uint64_t)(0x80000000ULL + 4 * idx));
+      data.insert(data.end(), line, line + n);
+      if (writer != nullptr && (i + 1) % STEPS_PER_BLOCK == 0) {
+        assert(writer->add_block(data.data(), data.size(), STEPS_PER_BLOCK));
+        data.clear();
+      }
+    }
+    if (writer != nullptr) {
+      assert(writer->close());
+      delete writer;
+    } else {
+      assert(write_trace_file(path, data.data(), data.size()));
+    }
+  }
+  FILE* done = fopen((dir + "/COSPIKE-TRACE-0-DONE").c_str(), "w");
+  fclose(done);
+}
+
+// Reads the trace starting at step first (seeking when first != 0) and
+// returns the number of units that were handed out
+static uint64_t read_from(const std::string& dir, uint64_t first, bool expect_index) {
+  trace_reader_t reader(0, 4, STEPS_PER_FILE + 1, 1, dir);
+  if (first != 0)
+    assert(reader.seek(step_time(first)) == expect_index);
+  reader.start();
+
+  uint64_t idx = first;
+  uint64_t units = 0;
+  trace_buffer_t* buf;
+  while ((buf = reader.cur_buffer()) != nullptr) {
+    for (rtl_step_t& s : *buf) {
+      if (s.time != step_time(idx)) {
+        printf("expected time %" PRIu64 "\n", step_time(idx));
+        s.print();
+        assert(false);
+      }
+      idx++;
+    }
+    reader.pop_buffer();
+    units++;
+  }
+  assert(idx == NFILES * STEPS_PER_FILE);
+  return units;
+}
+
+// Stops the replay after units units, as a workload that exits before the
+// end of its trace does
+static void read_units(const std::string& dir, uint64_t units) {
+  trace_reader_t reader(0, 4, STEPS_PER_FILE + 1, 1, dir);
+  reader.start();
+  for (uint64_t i = 0; i < units; i++) {
+    assert(reader.cur_buffer() != nullptr);
+    reader.pop_buffer();
+  }
+}
+
+int main() {
+  std::string dir = std::filesystem::temp_directory_path().string() +
+                    "/test_trace_seek." + std::to_string(getpid());
+  std::filesystem::create_directories(dir);
+  write_traces(dir);
+
+  // A replay that stops early indexes the units it consumed
+  std::vector<trace_time_unit_t> units;
+  read_units(dir, 3);
+  assert(read_trace_time_index(dir, 0, units));
+  assert(units.size() == 3);
+  printf("partial time index passed\n");
+
+  // Reading the whole trace extends it
+  uint64_t nunits = NFILES / 2 + (NFILES / 2) * (STEPS_PER_FILE / STEPS_PER_BLOCK);
+  assert(read_from(dir, 0, false) == nunits);
+
+  assert(read_trace_time_index(dir, 0, units));
+  assert(units.size() == nunits);
+  uint64_t steps = 0;
+  for (auto& u : units) {
+    assert(u.first_time == step_time(steps));
+    steps += u.steps;
+    assert(u.last_time == step_time(steps - 1));
+  }
+  printf("time index of %zu units passed\n", units.size());
+
+  // Into the middle of a block of file 3: only the rest of that block and
+  // the following blocks are decoded
+  uint64_t first = 3 * STEPS_PER_FILE + 4 * STEPS_PER_BLOCK + 123;
+  assert(read_from(dir, first, true) == STEPS_PER_FILE / STEPS_PER_BLOCK - 4);
+
+  // Into the middle of the plain file 2
+  first = 2 * STEPS_PER_FILE + 77;
+  assert(read_from(dir, first, true) == 1 + STEPS_PER_FILE / STEPS_PER_BLOCK);
+  printf("seek passed\n");
+
+  // Without the index the steps before the seek point are still dropped
+  std::filesystem::remove(trace_time_index_path(dir, 0));
+  assert(read_from(dir, first, false) == nunits);
+  printf("seek without index passed\n");
+
+  std::filesystem::remove_all(dir);
+  std::cout << "Test passed\n";
+  return 0;
+}
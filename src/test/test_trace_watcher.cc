@@ -0,0 +1,114 @@
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <filesystem>
+#include <assert.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <inttypes.h>
+#include "../lib/trace_reader.h"
+#include "../lib/trace_watcher.h"
+
+#define NFILES         8
+#define STEPS_PER_FILE 5000
+
+// Writes the trace the way FireSim does while the reader is already running:
+// one gzip file at a time, each one trickling in before it is closed,
+// followed by the end-of-trace marker
+static void write_live_trace(const std::string& dir) {
+  uint64_t time = 0;
+  for (int f = 0; f < NFILES; f++) {
+    std::string path = dir + "/COSPIKE-TRACE-0-" + std::to_string(f) + ".gz";
+    gzFile fp = gzopen(path.c_str(), "wb");
+    for (int i = 0; i < STEPS_PER_FILE; i++) {
+      gzprintf(fp, "0 %" PRIu64 " %" PRIx64 " 1 0 0 0 0 0\n", ++time, 0x80000000ULL + 4 * i);
+      if (i % 1000 == 0) {
+        gzflush(fp, Z_SYNC_FLUSH);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    }
+    gzclose(fp);
+  }
+  FILE* done = fopen((dir + "/COSPIKE-TRACE-0-DONE").c_str(), "w");
+  fclose(done);
+}
+
+// Replays a trace that is written while the reader is already running
+static uint64_t check_live_trace(const std::string& dir) {
+  trace_reader_t* reader = new trace_reader_t(0, 4, STEPS_PER_FILE + 1, 1, dir);
+  reader->start();
+  std::thread writer(write_live_trace, dir);
+
+  uint64_t steps = 0;
+  uint64_t last_time = 0;
+  trace_buffer_t* buf;
+  while ((buf = reader->cur_buffer()) != nullptr) {
+    uint64_t buf_steps = 0;
+    while (!buf->empty()) {
+      rtl_step_t& step = buf->pop_front();
+      assert(step.time == last_time + 1);
+      last_time = step.time;
+      buf_steps++;
+    }
+    // A file must never be picked up before it was completely written
+    assert(buf_steps == STEPS_PER_FILE);
+    steps += buf_steps;
+    reader->pop_buffer();
+  }
+  assert(steps == NFILES * STEPS_PER_FILE);
+
+  writer.join();
+  delete reader;
+  return steps;
+}
+
+// Starts a watcher on a directory holding a closed file 0 and a file 1 whose
+// writer stalled with the file open. Only closing file 1 completes it, no
+// matter how long ago it was modified.
+static void check_stalled_writer(const std::string& dir) {
+  std::string path0 = dir + "/COSPIKE-TRACE-0-0";
+  std::string path1 = dir + "/COSPIKE-TRACE-0-1";
+  FILE* fp0 = fopen(path0.c_str(), "w");
+  fprintf(fp0, "0 1 80000000 1 0 0 0 0 0\n");
+  fclose(fp0);
+  FILE* fp1 = fopen(path1.c_str(), "w");
+  fprintf(fp1, "0 2 80000004 1 0 0 0 0 0\n");
+  fflush(fp1);
+  std::filesystem::last_write_time(path1,
+      std::filesystem::file_time_type::clock::now() - std::chrono::hours(1));
+
+  trace_watcher_t watcher(dir, 0);
+  std::atomic<bool> terminate(false);
+  assert(watcher.wait_for(0, terminate) == trace_watcher_t::TRACE_FILE_READY);
+
+  std::atomic<bool> ready(false);
+  std::thread waiter([&] {
+      assert(watcher.wait_for(1, terminate) == trace_watcher_t::TRACE_FILE_READY);
+      ready = true;
+      });
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  assert(!ready);
+  fclose(fp1);
+  waiter.join();
+
+  FILE* done = fopen((dir + "/COSPIKE-TRACE-0-DONE").c_str(), "w");
+  fclose(done);
+  assert(watcher.wait_for(2, terminate) == trace_watcher_t::TRACE_FILE_END);
+}
+
+int main() {
+  std::string dir = std::filesystem::temp_directory_path().string() +
+                    "/test_trace_watcher." + std::to_string(getpid());
+  std::filesystem::create_directories(dir);
+  uint64_t steps = check_live_trace(dir);
+  std::filesystem::remove_all(dir);
+
+  std::filesystem::create_directories(dir);
+  check_stalled_writer(dir);
+  std::filesystem::remove_all(dir);
+
+  std::cout << "Test passed: " << steps << " steps\n";
+  return 0;
+}